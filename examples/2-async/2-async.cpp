@@ -27,7 +27,7 @@ void loop() {
         if (Cellular.ready()) {
             unsigned long start = millis();
 
-            QuectelTowerRK::instance().scanWithCallback([start](QuectelTowerRK::TowerInfo towerInfo) {
+            QuectelTowerRK::instance().scanWithCallbackRef([start](const QuectelTowerRK::TowerInfo &towerInfo) {
                 // This code is execute later
                 unsigned long duration = millis() - start;
 
@@ -46,10 +46,12 @@ void loop() {
                 memset(&jsonBuf, 0, sizeof(jsonBuf));
                 JSONBufferWriter writer(jsonBuf, sizeof(jsonBuf) - 1);
 
-                // Second parameter (4) is the maximum number of towers to include in the array
-                towerInfo.toJsonWriter(writer, 4);
+                // Include as many towers as fit in the buffer, leaving room for the null terminator
+                QuectelTowerRK::TowerSelection selection;
+                towerInfo.selectTowers(sizeof(jsonBuf) - 1, selection);
+                towerInfo.toJsonWriter(writer, selection);
 
-                Log.info("json: %s", jsonBuf);
+                Log.info("json (%d towers, %d omitted, %d bytes): %s", (int)selection.numTowers(), (int)selection.towersOmitted, (int)selection.encodedSize, jsonBuf);
             });
 
 
@@ -27,7 +27,7 @@ void loop() {
         if (Cellular.ready()) {
             unsigned long start = millis();
 
-            QuectelTowerRK::instance().scanWithCallback([start](QuectelTowerRK::TowerInfo towerInfo) {
+            QuectelTowerRK::instance().scanWithCallbackRef([start](const QuectelTowerRK::TowerInfo &towerInfo) {
                 // This code is execute later
                 unsigned long duration = millis() - start;
 
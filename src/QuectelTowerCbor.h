@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Repository: https://github.com/rickkas7/QuectelTowerRK
+ * License: Apache 2.0
+ */
+
+#pragma once
+
+// This file does not use Device OS, so host-side tools can include it to decode QuectelTowerRK::TowerInfo::toCbor() data.
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Encoder and decoder for the CBOR (RFC 8949) format of QuectelTowerRK::TowerInfo::toCbor()
+ */
+namespace QuectelTowerCbor {
+
+/**
+ * @brief Integer keys in each tower map, see the table for TowerInfo::toCbor() in QuectelTowerRK.h
+ */
+enum class Key : uint8_t {
+    Rat = 0,
+    Mcc = 1,
+    Mnc = 2,
+    Lac = 3,
+    CellId = 4,
+    Str = 5,
+    NeighborId = 6,
+    Channel = 7,
+};
+
+/**
+ * @brief Highest key known to this version. Larger keys are ignored by decode().
+ */
+static const uint64_t KEY_MAX = (uint64_t)Key::Channel;
+
+/**
+ * @brief Writes the subset of CBOR used by TowerInfo::toCbor() to a fixed buffer
+ */
+class Writer {
+public:
+    Writer(uint8_t *buf, size_t bufSize) : buf(buf), bufSize(bufSize) {}
+
+    void beginArray(size_t count) { head(4, count); }
+    void beginMap(size_t count) { head(5, count); }
+
+    void pair(Key key, int64_t value) {
+        head(0, (uint64_t)key);
+        if (value >= 0) {
+            head(0, (uint64_t)value);
+        }
+        else {
+            head(1, (uint64_t)(-1 - value));
+        }
+    }
+
+    bool overflow() const { return size > bufSize; }
+    size_t getSize() const { return size; }
+
+protected:
+    void head(uint8_t majorType, uint64_t value) {
+        // Smallest encoding: in the initial byte, then 1, 2, 4, or 8 following bytes
+        uint8_t type = (uint8_t)(majorType << 5);
+        if (value < 24) {
+            put(type | (uint8_t)value);
+        }
+        else if (value <= UINT8_MAX) {
+            put(type | 24);
+            putBigEndian(value, 1);
+        }
+        else if (value <= UINT16_MAX) {
+            put(type | 25);
+            putBigEndian(value, 2);
+        }
+        else if (value <= UINT32_MAX) {
+            put(type | 26);
+            putBigEndian(value, 4);
+        }
+        else {
+            put(type | 27);
+            putBigEndian(value, 8);
+        }
+    }
+
+    void putBigEndian(uint64_t value, size_t numBytes) {
+        while(numBytes-- > 0) {
+            put((uint8_t)(value >> (numBytes * 8)));
+        }
+    }
+
+    void put(uint8_t value) {
+        if (size < bufSize) {
+            buf[size] = value;
+        }
+        size++;
+    }
+
+    uint8_t *buf;
+    size_t bufSize;
+    size_t size = 0;
+};
+
+/**
+ * @brief Reads the subset of CBOR written by Writer
+ */
+class Reader {
+public:
+    Reader(const uint8_t *buf, size_t size) : cur(buf), end(buf + size) {}
+
+    /**
+     * @brief Read an initial byte and its argument. Indefinite lengths and simple values are rejected.
+     */
+    bool head(uint8_t &majorType, uint64_t &value) {
+        if (cur >= end) {
+            return false;
+        }
+        majorType = *cur >> 5;
+        uint8_t info = *cur++ & 0x1f;
+        if (info < 24) {
+            value = info;
+            return true;
+        }
+        if (info > 27) {
+            return false;
+        }
+        size_t numBytes = (size_t)1 << (info - 24);
+        if ((size_t)(end - cur) < numBytes) {
+            return false;
+        }
+        value = 0;
+        while(numBytes-- > 0) {
+            value = (value << 8) | *cur++;
+        }
+        return true;
+    }
+
+    bool expect(uint8_t majorType, uint64_t &value) {
+        uint8_t actualType;
+        return head(actualType, value) && actualType == majorType;
+    }
+
+    bool readInt(int64_t &value) {
+        uint8_t majorType;
+        uint64_t arg;
+        if (!head(majorType, arg) || arg > INT64_MAX) {
+            return false;
+        }
+        if (majorType == 0) {
+            value = (int64_t)arg;
+            return true;
+        }
+        if (majorType == 1) {
+            value = -1 - (int64_t)arg;
+            return true;
+        }
+        return false;
+    }
+
+    bool atEnd() const { return cur == end; }
+
+protected:
+    const uint8_t *cur;
+    const uint8_t *end;
+};
+
+/**
+ * @brief One tower from decode(). Fields that were not in the data are 0, except rat which is -1.
+ */
+struct Tower {
+    bool isServing = false; //!< true if it has a cell ID (key 4), which only the serving cell has
+    int rat = -1; //!< QuectelTowerRK::RadioAccessTechnology as an integer (serving cell only), -1 is NONE
+    unsigned int mcc = 0; //!< Mobile Country Code (serving cell only)
+    unsigned int mnc = 0; //!< Mobile Network Code (serving cell only)
+    unsigned int lac = 0; //!< Location area code (serving cell only)
+    uint32_t cellId = 0; //!< Cell ID (serving cell only)
+    int signalPower = 0; //!< Signal power in dBm
+    uint32_t neighborId = 0; //!< Neighbor ID (neighbor cells only)
+    uint32_t channel = 0; //!< Channel (neighbor cells only)
+};
+
+/**
+ * @brief Decode data from TowerInfo::toCbor()
+ *
+ * @param buf Data from toCbor()
+ * @param size Size of the data in bytes
+ * @param onTower Called with a const Tower & for each tower, in order. Return false to stop decoding and fail.
+ * @return true if the data was valid and every call to onTower returned true
+ *
+ * Unknown integer keys are ignored so newer encoders can add fields. If this returns false, onTower may
+ * already have been called for the towers before the error.
+ */
+template<typename OnTower>
+bool decode(const uint8_t *buf, size_t size, OnTower onTower) {
+    Reader reader(buf, size);
+    uint64_t numTowers;
+
+    if (!reader.expect(4, numTowers)) {
+        return false;
+    }
+    for(uint64_t towerIndex = 0; towerIndex < numTowers; towerIndex++) {
+        uint64_t numPairs;
+        if (!reader.expect(5, numPairs)) {
+            return false;
+        }
+
+        Tower tower;
+        for(uint64_t ii = 0; ii < numPairs; ii++) {
+            uint64_t key;
+            int64_t value;
+            if (!reader.expect(0, key) || !reader.readInt(value)) {
+                return false;
+            }
+            if (key > KEY_MAX) {
+                continue;
+            }
+            switch((Key)key) {
+                case Key::Rat: tower.rat = (int)value; break;
+                case Key::Mcc: tower.mcc = (unsigned int)value; break;
+                case Key::Mnc: tower.mnc = (unsigned int)value; break;
+                case Key::Lac: tower.lac = (unsigned int)value; break;
+                case Key::CellId: tower.cellId = (uint32_t)value; tower.isServing = true; break;
+                case Key::Str: tower.signalPower = (int)value; break;
+                case Key::NeighborId: tower.neighborId = (uint32_t)value; break;
+                case Key::Channel: tower.channel = (uint32_t)value; break;
+            }
+        }
+        if (!onTower(tower)) {
+            return false;
+        }
+    }
+    return reader.atEnd();
+}
+
+} // namespace QuectelTowerCbor
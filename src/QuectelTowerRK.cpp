@@ -15,6 +15,11 @@
  */
 
 #include "QuectelTowerRK.h"
+#include "QuectelTowerCbor.h"
+
+#include <algorithm>
+#include <type_traits>
+#include <utility>
 
 #ifndef ARRAY_SIZE
     #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
@@ -23,78 +28,849 @@
 static Logger _log("app.tower");
 
 QuectelTowerRK *QuectelTowerRK::_instance = nullptr;
+std::atomic<QuectelTowerRK::ModemFamily> QuectelTowerRK::detectedModemFamily {QuectelTowerRK::ModemFamily::UNKNOWN};
+
+static_assert(std::is_trivially_copyable<QuectelTowerRK::TowerInfo>::value, "TowerInfo must be trivially copyable");
+
+/**
+ * @brief Single-pass tokenizer for +QENG response lines
+ * 
+ * Operates on a pointer and length, so the buffer does not need to be null terminated,
+ * and never allocates memory. Fields are separated by commas and may be surrounded by
+ * double quotes. This replaces sscanf, which is both large and slow for this purpose.
+ */
+class QengTokenizer {
+public:
+    /**
+     * @brief Construct a tokenizer for a buffer. The buffer is not copied.
+     * 
+     * @param buf Pointer to the response line (does not need to be null terminated)
+     * @param len Length of the response line in bytes
+     */
+    QengTokenizer(const char *buf, size_t len) : cur(buf), end(buf + len) {}
+
+    /**
+     * @brief Skip leading whitespace and the +QENG: prefix
+     * 
+     * @return true if the prefix was found
+     */
+    bool begin() {
+        static const char prefix[] = "+QENG:";
+
+        // Leading whitespace can include a CR LF left over from the previous line
+        while(cur < end && (*cur == ' ' || *cur == '\t' || *cur == '\r' || *cur == '\n')) {
+            cur++;
+        }
+        if ((size_t)(end - cur) < sizeof(prefix) - 1 || memcmp(cur, prefix, sizeof(prefix) - 1) != 0) {
+            return false;
+        }
+        cur += sizeof(prefix) - 1;
+        return true;
+    }
+
+    /**
+     * @brief Get the next field, without surrounding double quotes
+     * 
+     * @param fieldStart Filled in with a pointer to the first character of the field
+     * @param fieldLen Filled in with the length of the field
+     * @return true if a non-empty field was found
+     */
+    bool nextField(const char *&fieldStart, size_t &fieldLen) {
+        if (done) {
+            return false;
+        }
+        fieldIndex++;
+        skipWhitespace();
+
+        if (cur < end && *cur == '"') {
+            fieldStart = ++cur;
+            while(cur < end && *cur != '"') {
+                cur++;
+            }
+            if (cur >= end) {
+                // Unterminated quoted string
+                done = true;
+                return false;
+            }
+            fieldLen = cur++ - fieldStart;
+            skipWhitespace();
+        }
+        else {
+            fieldStart = cur;
+            while(cur < end && *cur != ',' && !isLineEnd(*cur)) {
+                cur++;
+            }
+            fieldLen = cur - fieldStart;
+            while(fieldLen > 0 && (fieldStart[fieldLen - 1] == ' ' || fieldStart[fieldLen - 1] == '\t')) {
+                fieldLen--;
+            }
+        }
+
+        if (cur < end && *cur == ',') {
+            cur++;
+        }
+        else {
+            done = true;
+        }
+        return fieldLen > 0;
+    }
+
+    /**
+     * @brief Skip the next field
+     * 
+     * @return true if a non-empty field was skipped
+     */
+    bool skipField() {
+        const char *fieldStart;
+        size_t fieldLen;
+        return nextField(fieldStart, fieldLen);
+    }
+
+    /**
+     * @brief Skip fields until the next field is the one at index
+     * 
+     * @param index Field index. The type field immediately after +QENG: is index 0.
+     * @return true if the field at index is available
+     */
+    bool skipTo(size_t index) {
+        while(fieldIndex < index && !done) {
+            skipField();
+        }
+        return fieldIndex == index && !done;
+    }
+
+    /**
+     * @brief Returns true if the next field is exactly str
+     */
+    bool nextFieldEquals(const char *str) {
+        const char *fieldStart;
+        size_t fieldLen;
+        return nextField(fieldStart, fieldLen) && fieldLen == strlen(str) && memcmp(fieldStart, str, fieldLen) == 0;
+    }
+
+    /**
+     * @brief Returns true if the next field begins with str and has more after it
+     * 
+     * @param str String the field must start with
+     * @param rest If not null, filled in with a pointer to the part of the field after str
+     * @param restLen If not null, filled in with the length of the part of the field after str
+     */
+    bool nextFieldStartsWith(const char *str, const char **rest = nullptr, size_t *restLen = nullptr) {
+        const char *fieldStart;
+        size_t fieldLen;
+        size_t strLen = strlen(str);
+        if (!nextField(fieldStart, fieldLen) || fieldLen <= strLen || memcmp(fieldStart, str, strLen) != 0) {
+            return false;
+        }
+        if (rest && restLen) {
+            *rest = fieldStart + strLen;
+            *restLen = fieldLen - strLen;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Copy the next field into a buffer as a null-terminated string
+     * 
+     * @param buf Buffer to copy to
+     * @param bufSize Size of the buffer in bytes, including the null terminator
+     * @return true if the field was non-empty and fit in the buffer
+     */
+    bool nextString(char *buf, size_t bufSize) {
+        const char *fieldStart;
+        size_t fieldLen;
+        if (!nextField(fieldStart, fieldLen) || fieldLen >= bufSize) {
+            return false;
+        }
+        memcpy(buf, fieldStart, fieldLen);
+        buf[fieldLen] = 0;
+        return true;
+    }
+
+    /**
+     * @brief Parse the next field as an unsigned number
+     * 
+     * @param value Filled in with the value
+     * @param base 10 for decimal or 16 for hexadecimal
+     * @return true if the field was a valid number
+     */
+    bool nextUnsigned(uint32_t &value, int base) {
+        const char *fieldStart;
+        size_t fieldLen;
+        return nextField(fieldStart, fieldLen) && parseUnsigned(fieldStart, fieldLen, base, value);
+    }
+
+    /**
+     * @brief Parse the next field as a signed decimal number
+     * 
+     * @param value Filled in with the value
+     * @return true if the field was a valid number
+     */
+    bool nextInt(int &value) {
+        const char *fieldStart;
+        size_t fieldLen;
+        if (!nextField(fieldStart, fieldLen)) {
+            return false;
+        }
+
+        bool negative = false;
+        if (*fieldStart == '-' || *fieldStart == '+') {
+            negative = (*fieldStart == '-');
+            fieldStart++;
+            fieldLen--;
+        }
+
+        uint32_t temp;
+        if (!parseUnsigned(fieldStart, fieldLen, 10, temp)) {
+            return false;
+        }
+        value = negative ? -(int)temp : (int)temp;
+        return true;
+    }
+
+protected:
+    static bool isLineEnd(char c) {
+        return c == '\r' || c == '\n' || c == 0;
+    }
 
-QuectelTowerRK::QuectelTowerRK() : cellularSignalLastUpdate(0), thread(nullptr)
+    void skipWhitespace() {
+        while(cur < end && (*cur == ' ' || *cur == '\t')) {
+            cur++;
+        }
+    }
+
+    static bool parseUnsigned(const char *str, size_t len, int base, uint32_t &value) {
+        if (base == 16 && len > 2 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+            str += 2;
+            len -= 2;
+        }
+        if (len == 0) {
+            return false;
+        }
+
+        uint32_t result = 0;
+        for(size_t ii = 0; ii < len; ii++) {
+            char c = str[ii];
+            uint32_t digit;
+            if (c >= '0' && c <= '9') {
+                digit = c - '0';
+            }
+            else if (base == 16 && c >= 'A' && c <= 'F') {
+                digit = c - 'A' + 10;
+            }
+            else if (base == 16 && c >= 'a' && c <= 'f') {
+                digit = c - 'a' + 10;
+            }
+            else {
+                return false;
+            }
+            result = result * base + digit;
+        }
+        value = result;
+        return true;
+    }
+
+    const char *cur; //!< Current parsing position
+    const char *end; //!< One past the last character in the buffer
+    size_t fieldIndex = 0; //!< Index of the next field
+    bool done = false; //!< No more fields are available
+};
+
+/**
+ * @brief Type of a field in an AT+QENG response
+ */
+enum class QengFieldType : uint8_t {
+    String,         //!< Quoted or unquoted string, up to 15 characters
+    Unsigned,       //!< Unsigned decimal number
+    Hex,            //!< Unsigned hexadecimal number
+    Signed,         //!< Signed decimal number
+};
+
+/**
+ * @brief Member of CellularServing or CellularNeighbor that a field is stored in
+ */
+enum class QengDest : uint8_t {
+    Rat,            //!< rat (String)
+    Duplex,         //!< tdd (String, CellularServing only)
+    Mcc,            //!< mcc (CellularServing only)
+    Mnc,            //!< mnc (CellularServing only)
+    CellId,         //!< cellId (CellularServing only)
+    Pci,            //!< pci (CellularServing) or neighborId (CellularNeighbor)
+    Earfcn,         //!< earfcn
+    Band,           //!< band (CellularServing only)
+    UlBandwidth,    //!< ulBandwidth (CellularServing only)
+    DlBandwidth,    //!< dlBandwidth (CellularServing only)
+    Lac,            //!< lac (CellularServing only)
+    Rsrp,           //!< rsrp and signalPower (CellularServing) or signalPower (CellularNeighbor)
+    Rsrq,           //!< rsrq (CellularServing) or signalQuality (CellularNeighbor)
+    Rssi,           //!< rssi (CellularServing) or signalStrength (CellularNeighbor)
+    Sinr,           //!< sinr (CellularServing only)
+    Srxlev,         //!< srxlev (CellularServing only)
+};
+
+/**
+ * @brief One entry in a field schema table
+ * 
+ * Entries in a table must be in increasing index order. If a required field is missing or
+ * cannot be parsed, the response is rejected. Optional fields are left at their default values.
+ */
+struct QengField {
+    uint8_t index;          //!< Field index, 0 is the type field ("servingcell" or "neighbourcell intra")
+    QengFieldType type;     //!< How to parse the field
+    QengDest dest;          //!< Where to store the field
+    bool required;          //!< true if the response is rejected without this field
+};
+
+// +QENG: "servingcell","NOCONN","LTE","FDD",310,410,A1B2C3D,123,5110,12,3,3,1A2B,-95,-10,-65,15,28
+static constexpr QengField bg9xServingSchema[] = {
+    {2, QengFieldType::String, QengDest::Rat, true},
+    {3, QengFieldType::String, QengDest::Duplex, true},
+    {4, QengFieldType::Unsigned, QengDest::Mcc, true},
+    {5, QengFieldType::Unsigned, QengDest::Mnc, true},
+    {6, QengFieldType::Hex, QengDest::CellId, true},
+    {7, QengFieldType::Unsigned, QengDest::Pci, false},
+    {8, QengFieldType::Unsigned, QengDest::Earfcn, false},
+    {9, QengFieldType::Unsigned, QengDest::Band, false},
+    {10, QengFieldType::Unsigned, QengDest::UlBandwidth, false},
+    {11, QengFieldType::Unsigned, QengDest::DlBandwidth, false},
+    {12, QengFieldType::Hex, QengDest::Lac, true},
+    {13, QengFieldType::Signed, QengDest::Rsrp, true},
+    {14, QengFieldType::Signed, QengDest::Rsrq, false},
+    {15, QengFieldType::Signed, QengDest::Rssi, false},
+    {16, QengFieldType::Signed, QengDest::Sinr, false},
+    {17, QengFieldType::Signed, QengDest::Srxlev, false},
+};
+
+// EG91 and EG21 add CQI and tx_power before srxlev
+// +QENG: "servingcell","NOCONN","LTE","FDD",310,410,A1B2C3D,123,5110,12,3,3,1A2B,-95,-10,-65,15,12,-,28
+static constexpr QengField egxxServingSchema[] = {
+    {2, QengFieldType::String, QengDest::Rat, true},
+    {3, QengFieldType::String, QengDest::Duplex, true},
+    {4, QengFieldType::Unsigned, QengDest::Mcc, true},
+    {5, QengFieldType::Unsigned, QengDest::Mnc, true},
+    {6, QengFieldType::Hex, QengDest::CellId, true},
+    {7, QengFieldType::Unsigned, QengDest::Pci, false},
+    {8, QengFieldType::Unsigned, QengDest::Earfcn, false},
+    {9, QengFieldType::Unsigned, QengDest::Band, false},
+    {10, QengFieldType::Unsigned, QengDest::UlBandwidth, false},
+    {11, QengFieldType::Unsigned, QengDest::DlBandwidth, false},
+    {12, QengFieldType::Hex, QengDest::Lac, true},
+    {13, QengFieldType::Signed, QengDest::Rsrp, true},
+    {14, QengFieldType::Signed, QengDest::Rsrq, false},
+    {15, QengFieldType::Signed, QengDest::Rssi, false},
+    {16, QengFieldType::Signed, QengDest::Sinr, false},
+    {19, QengFieldType::Signed, QengDest::Srxlev, false},
+};
+
+// The neighbor layout is the same on all supported modems
+// +QENG: "neighbourcell intra","LTE",5110,123,-10,-95,-65,15,28,...
+static constexpr QengField neighborSchema[] = {
+    {1, QengFieldType::String, QengDest::Rat, true},
+    {2, QengFieldType::Unsigned, QengDest::Earfcn, true},
+    {3, QengFieldType::Unsigned, QengDest::Pci, true},
+    {4, QengFieldType::Signed, QengDest::Rsrq, true},
+    {5, QengFieldType::Signed, QengDest::Rsrp, true},
+    {6, QengFieldType::Signed, QengDest::Rssi, true},
+};
+
+static void setQengString(QuectelTowerRK::CellularServing &serving, QengDest dest, const char *str) {
+    switch(dest) {
+        case QengDest::Rat: serving.rat = QuectelTowerRK::parseRadioAccessTechnology(str); break;
+        case QengDest::Duplex: serving.tdd = (strcmp(str, "TDD") == 0); break;
+        default: break;
+    }
+}
+
+static void setQengValue(QuectelTowerRK::CellularServing &serving, QengDest dest, int32_t value) {
+    switch(dest) {
+        case QengDest::Mcc: serving.mcc = (unsigned int)value; break;
+        case QengDest::Mnc: serving.mnc = (unsigned int)value; break;
+        case QengDest::CellId: serving.cellId = (uint32_t)value; break;
+        case QengDest::Pci: serving.pci = (uint16_t)value; break;
+        case QengDest::Earfcn: serving.earfcn = (uint32_t)value; break;
+        case QengDest::Band: serving.band = (uint16_t)value; break;
+        case QengDest::UlBandwidth: serving.ulBandwidth = (uint8_t)value; break;
+        case QengDest::DlBandwidth: serving.dlBandwidth = (uint8_t)value; break;
+        case QengDest::Lac: serving.lac = (unsigned int)value; break;
+        case QengDest::Rsrp: serving.signalPower = (int)value; serving.rsrp = (int16_t)value; break;
+        case QengDest::Rsrq: serving.rsrq = (int16_t)value; break;
+        case QengDest::Rssi: serving.rssi = (int16_t)value; break;
+        case QengDest::Sinr: serving.sinr = (int16_t)value; break;
+        case QengDest::Srxlev: serving.srxlev = (int16_t)value; break;
+        default: break;
+    }
+}
+
+static void setQengString(QuectelTowerRK::CellularNeighbor &neighbor, QengDest dest, const char *str) {
+    if (dest == QengDest::Rat) {
+        neighbor.rat = QuectelTowerRK::parseRadioAccessTechnology(str);
+    }
+}
+
+static void setQengValue(QuectelTowerRK::CellularNeighbor &neighbor, QengDest dest, int32_t value) {
+    switch(dest) {
+        case QengDest::Earfcn: neighbor.earfcn = (uint32_t)value; break;
+        case QengDest::Pci: neighbor.neighborId = (uint32_t)value; break;
+        case QengDest::Rsrq: neighbor.signalQuality = (int)value; break;
+        case QengDest::Rsrp: neighbor.signalPower = (int)value; break;
+        case QengDest::Rssi: neighbor.signalStrength = (int)value; break;
+        default: break;
+    }
+}
+
+/**
+ * @brief Parse and store one field from a schema table
+ * 
+ * The field definition is a compile-time constant, so each instantiation compiles down to
+ * a skip to the field index, a single parse call, and a single store.
+ */
+template<typename T, const QengField *Schema, size_t I>
+static inline bool applyQengField(QengTokenizer &tok, T &obj) {
+    constexpr QengField field = Schema[I];
+
+    bool parsed = false;
+    if (tok.skipTo(field.index)) {
+        if constexpr (field.type == QengFieldType::String) {
+            char str[16];
+            parsed = tok.nextString(str, sizeof(str));
+            if (parsed) {
+                setQengString(obj, field.dest, str);
+            }
+        }
+        else if constexpr (field.type == QengFieldType::Signed) {
+            int value;
+            parsed = tok.nextInt(value);
+            if (parsed) {
+                setQengValue(obj, field.dest, (int32_t)value);
+            }
+        }
+        else {
+            uint32_t value;
+            parsed = tok.nextUnsigned(value, (field.type == QengFieldType::Hex) ? 16 : 10);
+            if (parsed) {
+                setQengValue(obj, field.dest, (int32_t)value);
+            }
+        }
+    }
+    return parsed || !field.required;
+}
+
+template<typename T, const QengField *Schema, size_t... I>
+static inline bool applyQengSchema(QengTokenizer &tok, T &obj, std::index_sequence<I...>) {
+    // Stops at the first required field that is missing
+    return (applyQengField<T, Schema, I>(tok, obj) && ...);
+}
+
+template<const QengField *Schema, size_t NumFields>
+static int parseServingSchema(QuectelTowerRK::CellularServing &serving, const char *in, size_t len) {
+    serving.clear();
+
+    QengTokenizer tok(in, len);
+    if (!tok.begin() || !tok.nextFieldEquals("servingcell")) {
+        return SYSTEM_ERROR_NOT_ENOUGH_DATA;
+    }
+    if (!applyQengSchema<QuectelTowerRK::CellularServing, Schema>(tok, serving, std::make_index_sequence<NumFields>())) {
+        // Do not leave the fields before the missing one, which would make serving look valid
+        serving.clear();
+        return SYSTEM_ERROR_NOT_ENOUGH_DATA;
+    }
+    if (serving.rat == QuectelTowerRK::RadioAccessTechnology::NONE) {
+        return SYSTEM_ERROR_NOT_SUPPORTED;
+    }
+    return SYSTEM_ERROR_NONE;
+}
+
+template<const QengField *Schema, size_t NumFields>
+static int parseNeighborSchema(QuectelTowerRK::CellularNeighbor &neighbor, const char *in, size_t len) {
+    neighbor.clear();
+
+    QengTokenizer tok(in, len);
+    const char *qualifier;
+    size_t qualifierLen;
+    if (!tok.begin() || !tok.nextFieldStartsWith("neighbourcell ", &qualifier, &qualifierLen)) {
+        return SYSTEM_ERROR_NOT_ENOUGH_DATA;
+    }
+    neighbor.type = QuectelTowerRK::parseNeighborType(qualifier, qualifierLen);
+    if (!applyQengSchema<QuectelTowerRK::CellularNeighbor, Schema>(tok, neighbor, std::make_index_sequence<NumFields>())) {
+        neighbor.clear();
+        return SYSTEM_ERROR_NOT_ENOUGH_DATA;
+    }
+    if (neighbor.rat == QuectelTowerRK::RadioAccessTechnology::NONE) {
+        return SYSTEM_ERROR_NOT_SUPPORTED;
+    }
+    return SYSTEM_ERROR_NONE;
+}
+
+static const QuectelTowerRK::QengParser bg9xParser = {
+    parseServingSchema<bg9xServingSchema, ARRAY_SIZE(bg9xServingSchema)>,
+    parseNeighborSchema<neighborSchema, ARRAY_SIZE(neighborSchema)>,
+};
+
+static const QuectelTowerRK::QengParser egxxParser = {
+    parseServingSchema<egxxServingSchema, ARRAY_SIZE(egxxServingSchema)>,
+    parseNeighborSchema<neighborSchema, ARRAY_SIZE(neighborSchema)>,
+};
+
+/**
+ * @brief Supported modems. To add a modem, add a row here, and a schema table if its layout is different.
+ */
+static const struct {
+    const char *modelPrefix; //!< Prefix of the AT+CGMM response
+    QuectelTowerRK::ModemFamily family; //!< Modem family
+    const QuectelTowerRK::QengParser *parser; //!< Parser for this family
+} modemFamilies[] = {
+    {"BG95", QuectelTowerRK::ModemFamily::BG95, &bg9xParser},
+    {"BG96", QuectelTowerRK::ModemFamily::BG96, &bg9xParser},
+    {"EG91", QuectelTowerRK::ModemFamily::EG91, &egxxParser},
+    {"EG21", QuectelTowerRK::ModemFamily::EG21, &egxxParser},
+};
+
+
+QuectelTowerRK::QuectelTowerRK() : receivedTowerInfo(nullptr), thread(nullptr)
 {
-    os_queue_create(&commandQueue, sizeof(CommandCode), 1, nullptr);
-    thread = new Thread("tracker_cellular", [this]() {QuectelTowerRK::threadFunction();}, OS_THREAD_PRIORITY_DEFAULT);
+    os_queue_create(&commandQueue, sizeof(CommandCode), COMMAND_QUEUE_SIZE, nullptr);
+    thread = new Thread("tracker_cellular", [this]() {QuectelTowerRK::threadFunction();}, OS_THREAD_PRIORITY_DEFAULT, THREAD_STACK_SIZE);
 }
 
 QuectelTowerRK::~QuectelTowerRK() {
 
 }
 
-int QuectelTowerRK::scanBlocking(TowerInfo &towerInfo, unsigned long timeoutMs) {
-    bool done = false;
+QuectelTowerRK &QuectelTowerRK::withSignalOnDemand(bool enable) {
+    signalOnDemand = enable;
+
+    // Wake the thread so it uses the new wait period
+    requestSignalRefresh();
+    return *this;
+}
+
+QuectelTowerRK &QuectelTowerRK::withSignalSource(SignalSource source, unsigned long pollPeriodMs) {
+    signalSource = source;
+    servingPollPeriodMs = pollPeriodMs;
+
+    // Wake the thread so it uses the new wait period
+    requestSignalRefresh();
+    return *this;
+}
+
+void QuectelTowerRK::requestSignalRefresh() {
+    if (!signalRefreshPending.exchange(true)) {
+        auto event = CommandCode::RefreshSignal;
+        if (os_queue_put(commandQueue, &event, 0, nullptr)) {
+            signalRefreshPending = false;
+        }
+    }
+}
 
-    unsigned long startMs = millis();
+int QuectelTowerRK::scanBlocking(TowerInfo &towerInfo, unsigned long timeoutMs, ScanOptions options) {
+    os_semaphore_t doneSemaphore = nullptr;
+    ScanId scanId = 0;
 
-    int ret = scanWithCallback([&done, &towerInfo](TowerInfo tempTowerInfo) {
-        done = true;
+    CHECK_FALSE(os_semaphore_create(&doneSemaphore, 1, 0), SYSTEM_ERROR_NO_MEMORY);
+
+    // The semaphore give/take also orders the write to towerInfo before it's read by this thread
+    int ret = scanWithCallbackRef([doneSemaphore, &towerInfo](const TowerInfo &tempTowerInfo) {
         towerInfo = tempTowerInfo;
-    });
+        os_semaphore_give(doneSemaphore, false);
+    }, &scanId, timeoutMs, options);
 
     if (ret == SYSTEM_ERROR_NONE) {
-        while(!done) {
-            if ((timeoutMs != 0) && (millis() - startMs >= timeoutMs)) {
-                cancelScan();
+        system_tick_t timeout = (timeoutMs != 0) ? (system_tick_t)timeoutMs : CONCURRENT_WAIT_FOREVER;
+
+        if (os_semaphore_take(doneSemaphore, timeout, false)) {
+            // Timed out. After cancelScan returns the callback can't be running or be called later,
+            // but it may have completed just before, so check again without waiting.
+            cancelScan(scanId);
+            if (os_semaphore_take(doneSemaphore, 0, false)) {
                 ret = SYSTEM_ERROR_TIMEOUT;
-                break;
             }
-            delay(1);
+        }
+        if (ret == SYSTEM_ERROR_NONE && towerInfo.status == ScanStatus::BACKOFF) {
+            ret = SYSTEM_ERROR_BUSY;
         }
     }
+
+    os_semaphore_destroy(doneSemaphore);
     return ret;
 }
 
-int QuectelTowerRK::scanWithCallback(std::function<void(TowerInfo towerInfo)> scanCallback) {
-    int ret = startScan();
-    if (ret == SYSTEM_ERROR_NONE) {
-        this->scanCallback = scanCallback;
+int QuectelTowerRK::scanIfOlderThan(TowerInfo &towerInfo, unsigned long maxAgeMs, unsigned long timeoutMs) {
+    if (maxAgeMs != 0 && getTowerInfo(towerInfo, maxAgeMs) == 0) {
+        return SYSTEM_ERROR_NONE;
     }
-    return ret;
+    return scanBlocking(towerInfo, timeoutMs);
+}
+
+int QuectelTowerRK::scanWithCallback(std::function<void(TowerInfo towerInfo)> scanCallback, ScanId *scanId, unsigned long timeoutMs, ScanOptions options) {
+    // The by-value callback is adapted to the reference callback, so it's copied only once
+    return scanWithCallbackRef(scanCallback, scanId, timeoutMs, options);
+}
+
+int QuectelTowerRK::scanWithCallbackRef(ScanCallbackRef scanCallback, ScanId *scanId, unsigned long timeoutMs, ScanOptions options) {
+    CHECK_TRUE(options != ScanOptions::NONE, SYSTEM_ERROR_INVALID_ARGUMENT);
+
+    const std::lock_guard<RecursiveMutex> lg(mutex);
+
+    CHECK_FALSE(numScanSubscribers >= MAX_SCAN_SUBSCRIBERS, SYSTEM_ERROR_BUSY);
+
+    // Joins the pending scan, if there is one
+    CHECK(queueScan());
+
+    if (++lastScanId == 0) {
+        ++lastScanId;
+    }
+    ScanSubscriber &subscriber = scanSubscribers[numScanSubscribers++];
+    subscriber.scanId = lastScanId;
+    subscriber.deadlineMs = timeoutToDeadline(timeoutMs);
+    subscriber.options = options;
+    subscriber.callback = std::move(scanCallback);
+
+    if (scanId) {
+        *scanId = lastScanId;
+    }
+    return SYSTEM_ERROR_NONE;
+}
+
+
+int QuectelTowerRK::startScan(ScanOptions options) {
+    CHECK_TRUE(options != ScanOptions::NONE, SYSTEM_ERROR_INVALID_ARGUMENT);
+
+    const std::lock_guard<RecursiveMutex> lg(mutex);
+
+    // Not associated with a scan ID, so only cancelScan() with no ID can cancel it
+    CHECK(queueScan());
+    scanRequestedWithoutId = true;
+    scanWithoutIdDeadlineMs = std::max(scanWithoutIdDeadlineMs, timeoutToDeadline(SCAN_TIMEOUT_DEFAULT_MS));
+    scanWithoutIdOptions = scanWithoutIdOptions | options;
+
+    return SYSTEM_ERROR_NONE;
 }
 
+int QuectelTowerRK::startScan(ScanId &scanId, unsigned long timeoutMs, ScanOptions options) {
+    return scanWithCallbackRef(nullptr, &scanId, timeoutMs, options);
+}
 
-int QuectelTowerRK::startScan() {
-    auto event = CommandCode::Measure;
-    CHECK_FALSE(os_queue_put(commandQueue, &event, 0, nullptr), SYSTEM_ERROR_BUSY);
+// [static]
+uint64_t QuectelTowerRK::timeoutToDeadline(unsigned long timeoutMs) {
+    return (timeoutMs != 0) ? System.millis() + timeoutMs : UINT64_MAX;
+}
+
+int QuectelTowerRK::queueScan() {
+    const std::lock_guard<RecursiveMutex> lg(mutex);
 
+    if (!scanPending) {
+        auto event = CommandCode::Measure;
+        CHECK_FALSE(os_queue_put(commandQueue, &event, 0, nullptr), SYSTEM_ERROR_BUSY);
+        scanPending = true;
+    }
     return SYSTEM_ERROR_NONE;
 }
 
 void QuectelTowerRK::cancelScan() {
-    scanCallback = nullptr;
+    bool running;
+    {
+        const std::lock_guard<RecursiveMutex> lg(mutex);
+
+        for(size_t ii = 0; ii < numScanSubscribers; ii++) {
+            scanSubscribers[ii].callback = nullptr;
+        }
+        numScanSubscribers = 0;
+        numDispatchScanIds = 0;
+        scanRequestedWithoutId = false;
+        scanWithoutIdDeadlineMs = 0;
+        scanWithoutIdOptions = ScanOptions::NONE;
+        running = (runningScanId != 0);
+    }
+    if (running) {
+        waitForScanCallback();
+    }
+}
+
+int QuectelTowerRK::cancelScan(ScanId scanId) {
+    {
+        const std::lock_guard<RecursiveMutex> lg(mutex);
+
+        for(size_t ii = 0; ii < numScanSubscribers; ii++) {
+            if (scanSubscribers[ii].scanId == scanId) {
+                // Order doesn't matter, so move the last entry into this one
+                scanSubscribers[ii] = std::move(scanSubscribers[numScanSubscribers - 1]);
+                scanSubscribers[numScanSubscribers - 1].callback = nullptr;
+                numScanSubscribers--;
+                return SYSTEM_ERROR_NONE;
+            }
+        }
+        // The scan completed, but dispatchScanResult() has not called this callback yet
+        for(size_t ii = 0; ii < numDispatchScanIds; ii++) {
+            if (dispatchScanIds[ii] == scanId) {
+                dispatchScanIds[ii] = 0;
+                return SYSTEM_ERROR_NONE;
+            }
+        }
+        if (runningScanId != scanId) {
+            return SYSTEM_ERROR_NOT_FOUND;
+        }
+    }
+    // The callback is running on the worker thread
+    waitForScanCallback();
+    return SYSTEM_ERROR_NOT_FOUND;
 }
 
+void QuectelTowerRK::waitForScanCallback() {
+    // The worker thread holds callbackMutex while a callback runs. It's recursive, so this
+    // does not wait when called from the callback itself.
+    callbackMutex.lock();
+    callbackMutex.unlock();
+}
 
-int QuectelTowerRK::serving_cb(int type, const char* buf, int len, QuectelTowerRK* context) {
-    if (type == TYPE_OK) {
-        return RESP_OK;
+uint64_t QuectelTowerRK::getScanDeadlineMs(ScanOptions &options) {
+    const std::lock_guard<RecursiveMutex> lg(mutex);
+
+    // Requests share one scan, so it runs until the most patient one gives up and gets
+    // everything any of them asked for. Callers with an earlier deadline time out on their own.
+    uint64_t deadlineMs = 0;
+    options = ScanOptions::NONE;
+    if (scanRequestedWithoutId) {
+        deadlineMs = scanWithoutIdDeadlineMs;
+        options = scanWithoutIdOptions;
+    }
+    for(size_t ii = 0; ii < numScanSubscribers; ii++) {
+        deadlineMs = std::max(deadlineMs, scanSubscribers[ii].deadlineMs);
+        options = options | scanSubscribers[ii].options;
+    }
+    if (deadlineMs == 0) {
+        scanPending = false;
+    }
+    return deadlineMs;
+}
+
+int QuectelTowerRK::qengCommand(const char *type, uint64_t deadlineMs, int *sentResult, system_tick_t *sentTimeoutMs) {
+    // Leave time to deliver the result before the caller's own timeout
+    uint64_t nowMs = System.millis();
+    if (deadlineMs < nowMs + DEADLINE_MARGIN_MS + COMMAND_TIMEOUT_MIN_MS) {
+        return SYSTEM_ERROR_TIMEOUT;
+    }
+    uint64_t remainingMs = deadlineMs - nowMs - DEADLINE_MARGIN_MS;
+    system_tick_t timeoutMs = (system_tick_t)std::min(remainingMs, (uint64_t)COMMAND_TIMEOUT_MAX_MS);
+
+    lineAssembler.reset();
+    int ret = Cellular.command(qeng_cb, this, timeoutMs, "AT+QENG=\"%s\"\r\n", type);
+    if (sentResult) {
+        *sentResult = ret;
+    }
+    if (sentTimeoutMs) {
+        *sentTimeoutMs = timeoutMs;
+    }
+    if (ret != RESP_OK && System.millis() >= deadlineMs - DEADLINE_MARGIN_MS) {
+        ret = SYSTEM_ERROR_TIMEOUT;
+    }
+    return ret;
+}
+
+void QuectelTowerRK::dispatchScanResult(const TowerInfo &towerInfo) {
+    ScanCallbackRef callbacks[MAX_SCAN_SUBSCRIBERS];
+    ScanOptions callbackOptions[MAX_SCAN_SUBSCRIBERS];
+    size_t numCallbacks;
+
+    // The list is moved out first so a callback that starts a new scan subscribes to the new one.
+    // The IDs stay in dispatchScanIds until each callback is called, so they can still be cancelled.
+    {
+        const std::lock_guard<RecursiveMutex> lg(mutex);
+
+        scanPending = false;
+        scanRequestedWithoutId = false;
+        scanWithoutIdDeadlineMs = 0;
+        scanWithoutIdOptions = ScanOptions::NONE;
+        numCallbacks = numScanSubscribers;
+        for(size_t ii = 0; ii < numCallbacks; ii++) {
+            callbacks[ii] = std::move(scanSubscribers[ii].callback);
+            callbackOptions[ii] = scanSubscribers[ii].options;
+            scanSubscribers[ii].callback = nullptr;
+            dispatchScanIds[ii] = callbacks[ii] ? scanSubscribers[ii].scanId : 0;
+        }
+        numScanSubscribers = 0;
+        numDispatchScanIds = numCallbacks;
+    }
+
+    // The callbacks run without the mutex, so a slow callback does not block other threads from
+    // starting or cancelling scans. callbackMutex is taken before the mutex is released so
+    // cancelScan() cannot return between the check and the call.
+    for(size_t ii = 0; ii < numCallbacks; ii++) {
+        mutex.lock();
+        if (ii >= numDispatchScanIds || dispatchScanIds[ii] == 0) {
+            // Cancelled
+            mutex.unlock();
+            continue;
+        }
+        runningScanId = dispatchScanIds[ii];
+        dispatchScanIds[ii] = 0;
+        callbackMutex.lock();
+        mutex.unlock();
+
+        // Each request is COMPLETE if it got what it asked for. A request that joined after the worker
+        // thread last checked the options may have asked for more than the scan did.
+        ScanStatus status = towerInfo.status;
+        if (status == ScanStatus::COMPLETE || status == ScanStatus::PARTIAL) {
+            status = hasScanOption(towerInfo.contents, callbackOptions[ii]) ? ScanStatus::COMPLETE : ScanStatus::PARTIAL;
+        }
+        if (status == towerInfo.status) {
+            callbacks[ii](towerInfo);
+        }
+        else {
+            // Only a published result can be COMPLETE or PARTIAL, so the unpublished slot is free for the copy
+            TowerInfo &copy = beginTowerInfoUpdate();
+            copy = towerInfo;
+            copy.status = status;
+            callbacks[ii](copy);
+            abandonTowerInfoUpdate();
+        }
+
+        mutex.lock();
+        runningScanId = 0;
+        mutex.unlock();
+        callbackMutex.unlock();
+    }
+
+    const std::lock_guard<RecursiveMutex> lg(mutex);
+    numDispatchScanIds = 0;
+}
+
+
+int QuectelTowerRK::qeng_cb(int type, const char* buf, int len, QuectelTowerRK* context) {
+    // buf may contain a partial line, multiple lines, or URCs, so always go through the assembler
+    if (len > 0) {
+        context->lineAssembler.feed(buf, (size_t)len, *context->receivedTowerInfo);
+    }
+
+    if (type == TYPE_OK || type == TYPE_ERROR) {
+        context->lineAssembler.flush(*context->receivedTowerInfo);
+        return (type == TYPE_OK) ? RESP_OK : RESP_ERROR;
     }
 
-    context->receivedTowerInfo.parseServing(buf);
     return WAIT;
 }
 
-int QuectelTowerRK::neighbor_cb(int type, const char* buf, int len, QuectelTowerRK* context) {
+
+int QuectelTowerRK::cgmm_cb(int type, const char* buf, int len, ModemFamily* family) {
     if (type == TYPE_OK) {
         return RESP_OK;
     }
+    if (type == TYPE_UNKNOWN && len > 0 && *family == ModemFamily::UNKNOWN) {
+        *family = parseModemFamily(buf, (size_t)len);
+    }
+    return WAIT;
+}
 
-    context->receivedTowerInfo.parseNeighbor(buf);
+void QuectelTowerRK::detectModemFamily() {
+    ModemFamily family = ModemFamily::UNKNOWN;
 
-    return WAIT;
+    int ret = Cellular.command(cgmm_cb, &family, 10000, "AT+CGMM\r\n");
+    if (ret == RESP_OK) {
+        // The parser is selected once here and not checked again on every response
+        detectedModemFamily = family;
+        modemFamilyDetected = true;
+        lineAssembler.setParser(getQengParser(family));
+        _log.trace("modem family %d", (int)family);
+    }
 }
 
 
@@ -113,21 +889,36 @@ void QuectelTowerRK::threadFunction()
 {
     auto loop = true;
     while (loop) {
-        // Look for requests and provide a loop delay
-        auto event = waitOnEvent(PERIOD_SUCCESS_MS);
-
-        if (Cellular.ready()) {
-            // Grab the cellular strength on every loop iteration
-            auto rssi = Cellular.RSSI();
-
-            if (rssi.getStrengthValue() < 0) {
-                auto uptime = System.uptime();
-                WITH_LOCK(mutex) {
-                    cellularSignal = rssi;
-                    cellularSignalLastUpdate = uptime;
-                }
-            } else {
-                cellularSignalLastUpdate = 0;
+        // Look for requests. In periodic mode, this also provides the delay until the next signal check.
+        system_tick_t timeout = CONCURRENT_WAIT_FOREVER;
+        if (isSignalPeriodic()) {
+            int32_t untilNextCheck = (int32_t)(nextSignalCheckMs - millis());
+            timeout = (untilNextCheck > 0) ? (system_tick_t)untilNextCheck : 0;
+        }
+        auto event = waitOnEvent(timeout);
+
+        bool checkSignal = isSignalPeriodic();
+        if (event == CommandCode::RefreshSignal) {
+            signalRefreshPending = false;
+            checkSignal = true;
+        }
+        else if (event == CommandCode::Measure && signalSource == SignalSource::SERVING_CELL) {
+            // The scan sends AT+QENG="servingcell" anyway. If it does not update the signal, 
+            // the next check is still due and runs on the next pass through the loop.
+            checkSignal = false;
+        }
+
+        if (Cellular.ready() && !modemFamilyDetected) {
+            detectModemFamily();
+        }
+
+        // Not checked again until the success or error period has elapsed
+        if (checkSignal && (int32_t)(millis() - nextSignalCheckMs) >= 0) {
+            if (Cellular.ready()) {
+                updateSignal();
+            }
+            else {
+                nextSignalCheckMs = millis() + PERIOD_SUCCESS_MS;
             }
         }
 
@@ -136,6 +927,10 @@ void QuectelTowerRK::threadFunction()
                 // Do nothing
                 break;
 
+            case CommandCode::RefreshSignal:
+                // Handled above
+                break;
+
             case CommandCode::Exit:
                 // Get out of main loop and join
                 loop = false;
@@ -146,26 +941,123 @@ void QuectelTowerRK::threadFunction()
                 // to take inventory of what has been collected and data from the operation.
 
                 if (!Cellular.ready()) {
+                    // The saved scan is kept. Callbacks stay subscribed and are called when the next scan completes.
                     WITH_LOCK(mutex) {
-                        savedTowerInfo.clear();
+                        scanPending = false;
                     }
                     // The cellular modem is not even ready (maybe not powered) so leave
                     break;
                 }
 
-                WITH_LOCK(mutex) {
-                    receivedTowerInfo.clear();
+                // All requests may have been cancelled while the command was in the queue
+                ScanOptions options;
+                uint64_t deadlineMs = getScanDeadlineMs(options);
+                if (deadlineMs == 0) {
+                    break;
                 }
 
-                Cellular.command(serving_cb, this, 10000, "AT+QENG=\"servingcell\"\r\n");
-                Cellular.command(neighbor_cb, this, 10000, "AT+QENG=\"neighbourcell\"\r\n");
+                if (modemHealth.writerValue().scanBackoffUntilMs > System.millis()) {
+                    // Give Device OS a chance to recover the modem. The empty result is not saved.
+                    TowerInfo &towerInfo = beginTowerInfoUpdate();
+                    towerInfo.status = ScanStatus::BACKOFF;
+                    dispatchScanResult(towerInfo);
+                    abandonTowerInfoUpdate();
+                    break;
+                }
 
-                WITH_LOCK(mutex) {
-                    savedTowerInfo = receivedTowerInfo;
+                TowerInfo &towerInfo = beginTowerInfoUpdate();
+                ScanOptions attempted = ScanOptions::NONE;
+                bool timedOut = false;
+                bool abandoned = false;
+                bool modemAnswered = false;
+                int modemFailure = RESP_OK; // First failure that was the modem's fault
+
+                // A request can join while a command is running, so the options are checked again after each one
+                while(true) {
+                    ScanOptions type;
+                    if (hasScanOption(options, ScanOptions::SERVING) && !hasScanOption(attempted, ScanOptions::SERVING)) {
+                        type = ScanOptions::SERVING;
+                    }
+                    else if (hasScanOption(options, ScanOptions::NEIGHBORS) && !hasScanOption(attempted, ScanOptions::NEIGHBORS)) {
+                        type = ScanOptions::NEIGHBORS;
+                    }
+                    else {
+                        break;
+                    }
+                    attempted = attempted | type;
+
+                    if (type == ScanOptions::NEIGHBORS && reuseNeighbors(towerInfo)) {
+                        towerInfo.contents = towerInfo.contents | type;
+                        continue;
+                    }
+
+                    int sentResult = RESP_OK;
+                    system_tick_t sentTimeoutMs = 0;
+                    int ret = qengCommand((type == ScanOptions::SERVING) ? "servingcell" : "neighbourcell", deadlineMs, &sentResult, &sentTimeoutMs);
+                    if (sentTimeoutMs != 0 && modemFailure == RESP_OK) {
+                        // Running out of a short budget is not the modem's fault, and neighbourcell can 
+                        // return ERROR when there are no neighbors
+                        bool fullTimeout = sentResult != RESP_OK && sentResult != RESP_ERROR && sentTimeoutMs >= COMMAND_TIMEOUT_MAX_MS;
+                        bool servingError = type == ScanOptions::SERVING && sentResult == RESP_ERROR;
+                        if (fullTimeout || servingError) {
+                            modemFailure = sentResult;
+                        }
+                    }
+                    // After a good serving cell, a neighbourcell ERROR means there are no neighbors,
+                    // so the scan is still complete and can be served from the cache
+                    bool noNeighbors = type == ScanOptions::NEIGHBORS && ret == RESP_ERROR && 
+                        hasScanOption(towerInfo.contents, ScanOptions::SERVING);
+                    if (ret == RESP_OK || noNeighbors) {
+                        modemAnswered = true;
+                        towerInfo.contents = towerInfo.contents | type;
+                        if (type == ScanOptions::NEIGHBORS) {
+                            towerInfo.neighborsUpdatedMs = System.millis();
+                        }
+                    }
+                    else if (ret == SYSTEM_ERROR_TIMEOUT) {
+                        // Return what we have
+                        timedOut = true;
+                        break;
+                    }
+
+                    ScanOptions nextOptions;
+                    uint64_t nextDeadlineMs = getScanDeadlineMs(nextOptions);
+                    if (nextDeadlineMs == 0) {
+                        // Release the modem sooner if all requests were cancelled during the command.
+                        // A partial result is not published, but a finished one is still saved.
+                        abandoned = !hasScanOption(attempted, options);
+                        break;
+                    }
+                    options = nextOptions;
+                    deadlineMs = nextDeadlineMs;
                 }
-                if (scanCallback) {
-                    scanCallback(savedTowerInfo);
+                // Any data from the modem counts as a success, so a partial result does not start a backoff
+                if (modemAnswered) {
+                    recordScanResult(SYSTEM_ERROR_NONE);
                 }
+                else if (modemFailure != RESP_OK) {
+                    recordScanResult(modemFailure);
+                }
+                if (abandoned) {
+                    abandonTowerInfoUpdate();
+                    break;
+                }
+
+                if (signalSource == SignalSource::SERVING_CELL && hasScanOption(towerInfo.contents, ScanOptions::SERVING)) {
+                    updateSignalFromServing(towerInfo.serving);
+                }
+
+                if (towerInfo.contents == ScanOptions::NONE) {
+                    // Like a backoff, the empty result is not saved, so getTowerInfo() still returns the last good scan
+                    towerInfo.status = timedOut ? ScanStatus::TIMEOUT : ScanStatus::FAILED;
+                    dispatchScanResult(towerInfo);
+                    abandonTowerInfoUpdate();
+                    break;
+                }
+                towerInfo.status = hasScanOption(towerInfo.contents, options) ? ScanStatus::COMPLETE : ScanStatus::PARTIAL;
+
+                // The published slot is not modified again until after the callbacks return
+                dispatchScanResult(publishTowerInfo());
                 break;
             }
 
@@ -178,37 +1070,259 @@ void QuectelTowerRK::threadFunction()
     thread->cancel();
 }
 
+void QuectelTowerRK::updateSignal()
+{
+    if (signalSource == SignalSource::SERVING_CELL) {
+        // The unpublished slot is free between scans, so use it to receive the serving cell
+        TowerInfo &towerInfo = beginTowerInfoUpdate();
+        int ret = qengCommand("servingcell", System.millis() + COMMAND_TIMEOUT_MAX_MS + DEADLINE_MARGIN_MS);
+        bool success = (ret == RESP_OK) && updateSignalFromServing(towerInfo.serving);
+        abandonTowerInfoUpdate();
+
+        if (!success) {
+            SignalSnapshot &snapshot = signalSnapshot.beginWrite();
+            snapshot.updatedMs = 0;
+            signalSnapshot.endWrite();
+            recordSignalResult((ret == RESP_OK) ? SYSTEM_ERROR_NOT_FOUND : ret);
+        }
+        return;
+    }
+
+    auto rssi = Cellular.RSSI();
+
+    SignalSnapshot &snapshot = signalSnapshot.beginWrite();
+    bool success = rssi.getStrengthValue() < 0;
+    if (success) {
+        snapshot.signal = rssi;
+        snapshot.updatedMs = System.millis();
+    } else {
+        snapshot.updatedMs = 0;
+    }
+    signalSnapshot.endWrite();
+
+    recordSignalResult(success ? SYSTEM_ERROR_NONE : SYSTEM_ERROR_UNKNOWN);
+}
+
+void QuectelTowerRK::recordSignalResult(int result) {
+    ModemHealth &health = modemHealth.beginWrite();
+    health.lastSignalResult = result;
+    if (result == SYSTEM_ERROR_NONE) {
+        health.signalFailures = 0;
+        health.lastSignalSuccessMs = System.millis();
+        nextSignalCheckMs = millis() + getSignalPeriodMs();
+    }
+    else {
+        if (health.signalFailures < UINT16_MAX) {
+            health.signalFailures++;
+        }
+        nextSignalCheckMs = millis() + getBackoffMs(health.signalFailures);
+    }
+    modemHealth.endWrite();
+}
+
+bool QuectelTowerRK::isSignalPeriodic() const {
+    if (signalOnDemand) {
+        return false;
+    }
+    return signalSource == SignalSource::RSSI || servingPollPeriodMs != 0;
+}
+
+system_tick_t QuectelTowerRK::getSignalPeriodMs() const {
+    if (!signalOnDemand && signalSource == SignalSource::SERVING_CELL && servingPollPeriodMs != 0) {
+        return (system_tick_t)servingPollPeriodMs;
+    }
+    return PERIOD_SUCCESS_MS;
+}
+
+void QuectelTowerRK::recordScanResult(int result) {
+    ModemHealth &health = modemHealth.beginWrite();
+    health.lastScanResult = result;
+    if (result == SYSTEM_ERROR_NONE) {
+        health.scanFailures = 0;
+        health.lastScanSuccessMs = System.millis();
+        health.scanBackoffUntilMs = 0;
+    }
+    else {
+        if (health.scanFailures < UINT16_MAX) {
+            health.scanFailures++;
+        }
+        health.scanBackoffUntilMs = System.millis() + getBackoffMs(health.scanFailures);
+    }
+    modemHealth.endWrite();
+}
+
+// [static]
+system_tick_t QuectelTowerRK::getBackoffMs(uint16_t failures) {
+    system_tick_t backoffMs = PERIOD_ERROR_MS;
+    for(uint16_t ii = 1; ii < failures && backoffMs < BACKOFF_MAX_MS; ii++) {
+        backoffMs *= 2;
+    }
+    backoffMs = std::min(backoffMs, BACKOFF_MAX_MS);
+
+    // Jitter keeps devices that failed at the same time (like a tower outage) from retrying together
+    return backoffMs + (system_tick_t)random(backoffMs / 4 + 1);
+}
+
+bool QuectelTowerRK::updateSignalFromServing(const CellularServing &serving) {
+    CellularSignal signal;
+    if (!signalFromServing(serving, signal)) {
+        return false;
+    }
+
+    SignalSnapshot &snapshot = signalSnapshot.beginWrite();
+    snapshot.signal = signal;
+    snapshot.updatedMs = System.millis();
+    signalSnapshot.endWrite();
+
+    // A scan counts as a poll, so this also postpones the next one
+    recordSignalResult(SYSTEM_ERROR_NONE);
+    return true;
+}
+
+// [static]
+bool QuectelTowerRK::signalFromServing(const CellularServing &serving, CellularSignal &signal) {
+    if (serving.rat == RadioAccessTechnology::NONE || serving.rsrp == CellularServing::VALUE_NOT_AVAILABLE) {
+        return false;
+    }
+
+    cellular_signal_t sig = {};
+    sig.size = sizeof(sig);
+
+    // RadioAccessTechnology uses the same values as hal_net_access_tech_t
+    sig.rat = (hal_net_access_tech_t)serving.rat;
+
+    // Same units as Device OS: RSRP and RSRQ in hundredths of a dB, strength and quality scaled to 0 - 65535
+    int32_t rsrp = std::min(std::max((int32_t)serving.rsrp, (int32_t)-140), (int32_t)-44);
+    sig.rsrp = rsrp * 100;
+    sig.strength = (rsrp + 140) * 65535 / 96;
+
+    if (serving.rsrq != CellularServing::VALUE_NOT_AVAILABLE) {
+        int32_t rsrq = std::min(std::max((int32_t)serving.rsrq * 10, (int32_t)-195), (int32_t)-30);
+        sig.rsrq = rsrq * 10;
+        sig.quality = (rsrq + 195) * 65535 / 165;
+    }
+
+    return signal.fromHalCellularSignal(sig);
+}
+
 int QuectelTowerRK::getSignal(CellularSignal &signal, unsigned int max_age)
 {
-    const std::lock_guard<RecursiveMutex> lg(mutex);
+    SignalSnapshot snapshot;
+    signalSnapshot.read(snapshot);
 
-    if(!cellularSignalLastUpdate || System.uptime() - cellularSignalLastUpdate > max_age)
+    if(!snapshot.isValid() || snapshot.getAgeMs() > (uint64_t)max_age * 1000)
     {
+        if (signalOnDemand) {
+            requestSignalRefresh();
+        }
         return -ENODATA;
     }
 
-    signal = cellularSignal;
+    signal = snapshot.signal;
     return 0;
 }
 
 unsigned int QuectelTowerRK::getSignalUpdate()
 {
-    return cellularSignalLastUpdate;
+    return (unsigned int)(getSignalUpdateMs() / 1000);
+}
+
+uint64_t QuectelTowerRK::getSignalUpdateMs()
+{
+    SignalSnapshot snapshot;
+    signalSnapshot.read(snapshot);
+
+    return snapshot.updatedMs;
+}
+
+void QuectelTowerRK::getTowerInfo(TowerInfo &towerInfo) const {
+    // The slot only changes out from under the reader if two scans complete during the copy,
+    // in which case the read is retried with the new published slot
+    while(true) {
+        uint32_t generation = towerInfoGeneration.load(std::memory_order_acquire);
+        if (towerInfoSlots[generation % 2].tryRead(towerInfo)) {
+            break;
+        }
+    }
+}
+
+int QuectelTowerRK::getTowerInfo(TowerInfo &towerInfo, unsigned long maxAgeMs) const {
+    getTowerInfo(towerInfo);
+    if (!towerInfo.isFresh(maxAgeMs)) {
+        return -ENODATA;
+    }
+    return 0;
+}
+
+QuectelTowerRK::TowerInfo &QuectelTowerRK::beginTowerInfoUpdate() {
+    uint32_t generation = towerInfoGeneration.load(std::memory_order_relaxed);
+
+    receivedTowerInfo = &towerInfoSlots[(generation + 1) % 2].beginWrite();
+    receivedTowerInfo->clear();
+    return *receivedTowerInfo;
 }
 
-void QuectelTowerRK::getTowerInfo(TowerInfo &towerInfo) {
-    WITH_LOCK(mutex) {
-        towerInfo = savedTowerInfo;
+bool QuectelTowerRK::reuseNeighbors(TowerInfo &towerInfo) {
+    if (neighborReuseMaxAgeMs == 0 || !hasScanOption(towerInfo.contents, ScanOptions::SERVING)) {
+        return false;
     }
+
+    // Only the worker thread writes the slots, so the published one can be read here without the seqlock
+    const TowerInfo &previous = towerInfoSlots[towerInfoGeneration.load(std::memory_order_relaxed) % 2].writerValue();
+    if (!hasScanOption(previous.contents, ScanOptions::NEIGHBORS) || previous.neighborsUpdatedMs == 0 ||
+        previous.getNeighborsAgeMs() > neighborReuseMaxAgeMs || !towerInfo.serving.isSameCell(previous.serving)) {
+        return false;
+    }
+
+    towerInfo.neighbors = previous.neighbors;
+    towerInfo.neighborsDiscarded = previous.neighborsDiscarded;
+    towerInfo.neighborsUpdatedMs = previous.neighborsUpdatedMs;
+    towerInfo.neighborsReused = true;
+    return true;
+}
+
+void QuectelTowerRK::abandonTowerInfoUpdate() {
+    uint32_t generation = towerInfoGeneration.load(std::memory_order_relaxed);
+
+    // Readers only use the published slot, so it doesn't matter that this one was cleared
+    towerInfoSlots[(generation + 1) % 2].endWrite();
+    receivedTowerInfo = nullptr;
+}
+
+const QuectelTowerRK::TowerInfo &QuectelTowerRK::publishTowerInfo() {
+    uint32_t generation = towerInfoGeneration.load(std::memory_order_relaxed) + 1;
+
+    receivedTowerInfo->updatedMs = System.millis();
+    towerInfoSlots[generation % 2].endWrite();
+    towerInfoGeneration.store(generation, std::memory_order_release);
+    receivedTowerInfo = nullptr;
+
+    return towerInfoSlots[generation % 2].writerValue();
 }
 
 #ifdef SYSTEM_VERSION_v620
 // [static] 
 void QuectelTowerRK::addToEventHandler(Variant &eventData, Variant &locVariant) {
+    QuectelTowerRK &self = instance();
     TowerInfo towerInfo;
 
-    int result = instance().scanBlocking(towerInfo, 10000);
-    if (result == SYSTEM_ERROR_NONE) {
+    if (self.eventHandlerNonBlocking) {
+        // Attach what we have now and refresh in the background for the next event
+        if (self.getTowerInfo(towerInfo, self.towerInfoMaxAgeMs) != 0) {
+            self.startScan();
+        }
+        if (towerInfo.isValid() && towerInfo.updatedMs != 0 && towerInfo.getAgeMs() <= self.eventHandlerMaxStalenessMs) {
+            Variant towerArray;
+            towerInfo.toVariant(towerArray);
+            eventData.set("towers", towerArray);
+            eventData.set("towersAge", (unsigned int)(towerInfo.getAgeMs() / 1000));
+        }
+        return;
+    }
+
+    // A recent scan is used as-is so publishing does not wait on the modem
+    int result = self.scanIfOlderThan(towerInfo, self.towerInfoMaxAgeMs, 10000);
+    if (result == SYSTEM_ERROR_NONE && towerInfo.isValid()) {
         Variant towerArray;
         towerInfo.toVariant(towerArray);
         eventData.set("towers", towerArray);
@@ -234,38 +1348,61 @@ QuectelTowerRK::RadioAccessTechnology QuectelTowerRK::parseRadioAccessTechnology
     return rat;
 }
 
+// [static]
+QuectelTowerRK::NeighborType QuectelTowerRK::parseNeighborType(const char *str, size_t len) {
+    if (len == 5 && !strncmp(str, "intra", 5)) {
+        return NeighborType::INTRA;
+    }
+    if (len == 5 && !strncmp(str, "inter", 5)) {
+        return NeighborType::INTER;
+    }
+    return NeighborType::UNKNOWN;
+}
 
-int QuectelTowerRK::CellularServing::parse(const char *in) {
-    char stateStr[16] = {};
-    char ratStr[16] = {};
-
-    clear();
-
-    auto nitems = sscanf(in, " +QENG: \"servingcell\",\"%15[^\"]\",\"%15[^\"]\",\"%*15[^\"]\","
-            "%u,%u,%lX,"
-            "%*15[^,],%*15[^,],%*15[^,],%*15[^,],%*15[^,],%X,%d",
-            stateStr, ratStr,
-            &mcc, &mnc, &cellId, &lac, &signalPower);
+// [static] 
+QuectelTowerRK::ModemFamily QuectelTowerRK::parseModemFamily(const char *model, size_t len) {
+    // Skip the line terminators that may be in the response
+    while(len > 0 && (*model == '\r' || *model == '\n' || *model == ' ')) {
+        model++;
+        len--;
+    }
 
-    if (nitems < 7) {
-        return SYSTEM_ERROR_NOT_ENOUGH_DATA;
+    for(size_t ii = 0; ii < ARRAY_SIZE(modemFamilies); ii++) {
+        size_t prefixLen = strlen(modemFamilies[ii].modelPrefix);
+        if (len >= prefixLen && memcmp(model, modemFamilies[ii].modelPrefix, prefixLen) == 0) {
+            return modemFamilies[ii].family;
+        }
     }
+    return ModemFamily::UNKNOWN;
+}
 
-    rat = parseRadioAccessTechnology(ratStr);
-    if (rat == RadioAccessTechnology::NONE) {
-        return SYSTEM_ERROR_NOT_SUPPORTED;
+// [static] 
+const QuectelTowerRK::QengParser &QuectelTowerRK::getQengParser(ModemFamily family) {
+    for(size_t ii = 0; ii < ARRAY_SIZE(modemFamilies); ii++) {
+        if (modemFamilies[ii].family == family) {
+            return *modemFamilies[ii].parser;
+        }
     }
+    return bg9xParser;
+}
 
-    return SYSTEM_ERROR_NONE;
+
+int QuectelTowerRK::CellularServing::parse(const char *in) {
+    return parse(in, strlen(in));
+}
+
+int QuectelTowerRK::CellularServing::parse(const char *in, size_t len) {
+    return getDetectedQengParser().parseServing(*this, in, len);
 }
 
 String QuectelTowerRK::CellularServing::toString() const {
-    return String::format("rat=%d, mcc=%d, mnc=%d, lac=%d, cid=%d, str=%d", 
-        (int)rat, (int)mcc, (int)mnc, (int)lac, (int)cellId, (int)signalPower);
+    return String::format("rat=%d, mcc=%d, mnc=%d, lac=%d, cid=%d, str=%d, pci=%d, ch=%d, band=%d, rsrq=%d, rssi=%d, sinr=%d", 
+        (int)rat, (int)mcc, (int)mnc, (int)lac, (int)cellId, (int)signalPower,
+        (int)pci, (int)earfcn, (int)band, (int)rsrq, (int)rssi, (int)sinr);
 }
 
 
-QuectelTowerRK::CellularServing &QuectelTowerRK::CellularServing::toJsonWriter(JSONWriter &writer, bool wrapInObject) {
+const QuectelTowerRK::CellularServing &QuectelTowerRK::CellularServing::toJsonWriter(JSONWriter &writer, bool wrapInObject) const {
 
     if (wrapInObject) {
         writer.beginObject();
@@ -286,20 +1423,26 @@ QuectelTowerRK::CellularServing &QuectelTowerRK::CellularServing::toJsonWriter(J
 }
 
 #ifdef SYSTEM_VERSION_v620
-QuectelTowerRK::CellularServing &QuectelTowerRK::CellularServing::toVariant(Variant &obj) {
+const QuectelTowerRK::CellularServing &QuectelTowerRK::CellularServing::toVariant(Variant &obj) const {
+    VariantMap &map = obj.asMap();
+    map.reserve(map.size() + 6);
 
-    obj.set("rat", Variant("lte"));
-    obj.set("mcc", Variant((unsigned)mcc));
-    obj.set("mnc", Variant((unsigned)mnc));
-    obj.set("lac", Variant((unsigned)lac));
-    obj.set("cid", Variant((unsigned)cellId));
-    obj.set("str", Variant(signalPower));
+    map.set("rat", Variant("lte"));
+    map.set("mcc", Variant((unsigned)mcc));
+    map.set("mnc", Variant((unsigned)mnc));
+    map.set("lac", Variant((unsigned)lac));
+    map.set("cid", Variant((unsigned)cellId));
+    map.set("str", Variant(signalPower));
 
     return *this;
 }
 #endif // SYSTEM_VERSION_v620
 
 
+bool QuectelTowerRK::CellularServing::isSameCell(const CellularServing &other) const {
+    return rat == other.rat && mcc == other.mcc && mnc == other.mnc && lac == other.lac && cellId == other.cellId;
+}
+
 void QuectelTowerRK::CellularServing::clear() {
     rat = RadioAccessTechnology::NONE;
     mcc = 0;
@@ -307,31 +1450,34 @@ void QuectelTowerRK::CellularServing::clear() {
     cellId = 0;
     lac = 0;
     signalPower = 0;
+    tdd = false;
+    pci = 0;
+    earfcn = 0;
+    band = 0;
+    ulBandwidth = 0;
+    dlBandwidth = 0;
+    rsrp = VALUE_NOT_AVAILABLE;
+    rsrq = VALUE_NOT_AVAILABLE;
+    rssi = VALUE_NOT_AVAILABLE;
+    sinr = VALUE_NOT_AVAILABLE;
+    srxlev = VALUE_NOT_AVAILABLE;
 }
+
 bool QuectelTowerRK::CellularServing::isValid() const {
     return rat != RadioAccessTechnology::NONE;
 }
 
+bool QuectelTowerRK::CellularServing::hasQuality() const {
+    return rsrq != VALUE_NOT_AVAILABLE && rssi != VALUE_NOT_AVAILABLE && sinr != VALUE_NOT_AVAILABLE;
+}
 
-int QuectelTowerRK::CellularNeighbor::parse(const char *in) {
-    char ratStr[16] = {0};
-
-    clear();
-
-    auto nitems = sscanf(in, " +QENG: \"neighbourcell %*15[^\"]\",\"%15[^\"]\",%lu,%lu,%d,%d,%d",
-            ratStr,
-            &earfcn, &neighborId, &signalQuality, &signalPower, &signalStrength);
-
-    if (nitems < 6) {
-        return SYSTEM_ERROR_NOT_ENOUGH_DATA;
-    }
 
-    rat = parseRadioAccessTechnology(ratStr);
-    if (rat == RadioAccessTechnology::NONE) {
-        return SYSTEM_ERROR_NOT_SUPPORTED;
-    }
+int QuectelTowerRK::CellularNeighbor::parse(const char *in) {
+    return parse(in, strlen(in));
+}
 
-    return SYSTEM_ERROR_NONE;
+int QuectelTowerRK::CellularNeighbor::parse(const char *in, size_t len) {
+    return getDetectedQengParser().parseNeighbor(*this, in, len);
 }
 
 String QuectelTowerRK::CellularNeighbor::toString() const {
@@ -339,7 +1485,7 @@ String QuectelTowerRK::CellularNeighbor::toString() const {
 }
 
 
-QuectelTowerRK::CellularNeighbor &QuectelTowerRK::CellularNeighbor::toJsonWriter(JSONWriter &writer, bool wrapInObject) {
+const QuectelTowerRK::CellularNeighbor &QuectelTowerRK::CellularNeighbor::toJsonWriter(JSONWriter &writer, bool wrapInObject) const {
 
     if (wrapInObject) {
         writer.beginObject();
@@ -358,11 +1504,13 @@ QuectelTowerRK::CellularNeighbor &QuectelTowerRK::CellularNeighbor::toJsonWriter
 
 
 #ifdef SYSTEM_VERSION_v620
-QuectelTowerRK::CellularNeighbor &QuectelTowerRK::CellularNeighbor::toVariant(Variant &obj) {
+const QuectelTowerRK::CellularNeighbor &QuectelTowerRK::CellularNeighbor::toVariant(Variant &obj) const {
+    VariantMap &map = obj.asMap();
+    map.reserve(map.size() + 3);
 
-    obj.set("nid", Variant((unsigned)neighborId));
-    obj.set("ch", Variant((unsigned)earfcn));
-    obj.set("str", Variant(signalPower));
+    map.set("nid", Variant((unsigned)neighborId));
+    map.set("ch", Variant((unsigned)earfcn));
+    map.set("str", Variant(signalPower));
 
     return *this;
 }
@@ -376,6 +1524,7 @@ void QuectelTowerRK::CellularNeighbor::clear() {
     signalQuality = 0;
     signalPower = 0;
     signalStrength = 0;
+    type = NeighborType::UNKNOWN;
 }
 
 bool QuectelTowerRK::CellularNeighbor::isValid() const {
@@ -383,42 +1532,146 @@ bool QuectelTowerRK::CellularNeighbor::isValid() const {
 }
 
 
-QuectelTowerRK::TowerInfo::TowerInfo() {
+int QuectelTowerRK::TowerInfo::parseServing(const char *in) {
+    return parseServing(in, strlen(in));
+}
 
+int QuectelTowerRK::TowerInfo::parseServing(const char *in, size_t len) {
+    return serving.parse(in, len);
 }
-QuectelTowerRK::TowerInfo::~TowerInfo() {
 
+int QuectelTowerRK::TowerInfo::parseServing(const char *in, size_t len, const QengParser &parser) {
+    return parser.parseServing(serving, in, len);
 }
 
-QuectelTowerRK::TowerInfo::TowerInfo(const QuectelTowerRK::TowerInfo &other) {
-    *this = other;
+int QuectelTowerRK::TowerInfo::parseNeighbor(const char *in) {
+    return parseNeighbor(in, strlen(in));
 }
 
-QuectelTowerRK::TowerInfo &QuectelTowerRK::TowerInfo::operator=(const QuectelTowerRK::TowerInfo &other) {
-    serving = other.serving;
+int QuectelTowerRK::TowerInfo::parseNeighbor(const char *in, size_t len) {
+    return parseNeighbor(in, len, getDetectedQengParser());
+}
 
-    neighbors.clear();  
-    for(auto it = other.neighbors.begin(); it != other.neighbors.end(); ++it) {
-        neighbors.push_back(*it);
+int QuectelTowerRK::TowerInfo::parseNeighbor(const char *in, size_t len, const QengParser &parser) {
+    CellularNeighbor neighbor;
+    int ret = parser.parseNeighbor(neighbor, in, len);
+    if (ret == SYSTEM_ERROR_NONE) {
+        addNeighbor(neighbor);
     }
+    return ret;
+}
 
-    return *this;
+static size_t neighborHash(const QuectelTowerRK::CellularNeighbor &neighbor) {
+    uint32_t key = (neighbor.earfcn * 1021) ^ (neighbor.neighborId * 31) ^ (uint32_t)neighbor.rat;
+    return (size_t)((key * 2654435761u) >> 16);
 }
 
-int QuectelTowerRK::TowerInfo::parseServing(const char *in) {
-    return serving.parse(in);
+static bool isSameNeighbor(const QuectelTowerRK::CellularNeighbor &a, const QuectelTowerRK::CellularNeighbor &b) {
+    return a.rat == b.rat && a.earfcn == b.earfcn && a.neighborId == b.neighborId;
 }
 
-int QuectelTowerRK::TowerInfo::parseNeighbor(const char *in) {
-    CellularNeighbor neighbor;
-    int ret = neighbor.parse(in);
-    if (ret == SYSTEM_ERROR_NONE) {
-        neighbors.push_back(neighbor);
+static bool isBetterNeighbor(const QuectelTowerRK::CellularNeighbor &a, const QuectelTowerRK::CellularNeighbor &b) {
+    if (a.signalPower != b.signalPower) {
+        return a.signalPower > b.signalPower;
     }
-    return ret;
+    return a.signalQuality > b.signalQuality;
+}
+
+void QuectelTowerRK::TowerInfo::rebuildNeighborTable() {
+    memset(neighborTable, 0, sizeof(neighborTable));
+    for(size_t ii = 0; ii < neighbors.size(); ii++) {
+        size_t slot = neighborHash(neighbors[ii]);
+        while(neighborTable[slot % NEIGHBOR_TABLE_SIZE] != 0) {
+            slot++;
+        }
+        neighborTable[slot % NEIGHBOR_TABLE_SIZE] = (uint8_t)(ii + 1);
+    }
+    neighborTableCount = (uint8_t)neighbors.size();
+}
+
+bool QuectelTowerRK::TowerInfo::addNeighbor(const CellularNeighbor &neighbor) {
+    // The serving cell can also show up in the neighbor list
+    if (serving.isValid() && serving.earfcn != 0 && neighbor.rat == serving.rat && 
+        neighbor.earfcn == serving.earfcn && neighbor.neighborId == serving.pci) {
+        return false;
+    }
+
+    if (neighborTableCount != neighbors.size()) {
+        rebuildNeighborTable();
+    }
+
+    // The table is at most half full, so there is always an empty slot
+    size_t slot = neighborHash(neighbor);
+    while(neighborTable[slot % NEIGHBOR_TABLE_SIZE] != 0) {
+        CellularNeighbor &existing = neighbors[neighborTable[slot % NEIGHBOR_TABLE_SIZE] - 1];
+        if (isSameNeighbor(existing, neighbor)) {
+            // Duplicate, keep the one with the better signal
+            if (!isBetterNeighbor(neighbor, existing)) {
+                return false;
+            }
+            existing = neighbor;
+            return true;
+        }
+        slot++;
+    }
+
+    if (neighbors.push_back(neighbor)) {
+        neighborTable[slot % NEIGHBOR_TABLE_SIZE] = (uint8_t)neighbors.size();
+        neighborTableCount = (uint8_t)neighbors.size();
+        return true;
+    }
+
+    // Full, so keep the strongest neighbors
+    neighborsDiscarded++;
+
+    size_t weakest = 0;
+    for(size_t ii = 1; ii < neighbors.size(); ii++) {
+        if (neighbors[ii].signalPower < neighbors[weakest].signalPower) {
+            weakest = ii;
+        }
+    }
+    if (neighbor.signalPower <= neighbors[weakest].signalPower) {
+        return false;
+    }
+    neighbors[weakest] = neighbor;
+
+    // Removing a key from an open-addressed table would break the probe sequences of the others
+    rebuildNeighborTable();
+    return true;
+}
+
+int QuectelTowerRK::TowerInfo::parseLine(const char *in, size_t len) {
+    return parseLine(in, len, getDetectedQengParser());
+}
+
+int QuectelTowerRK::TowerInfo::parseLine(const char *in, size_t len, const QengParser &parser) {
+    static const char servingPrefix[] = "\"servingcell\"";
+    static const char neighborPrefix[] = "\"neighbourcell";
+
+    // Find the type field after the +QENG: prefix
+    size_t offset = 0;
+    while(offset < len && in[offset] != ':') {
+        offset++;
+    }
+    offset++;
+    while(offset < len && in[offset] == ' ') {
+        offset++;
+    }
+    if (offset >= len) {
+        return SYSTEM_ERROR_NOT_SUPPORTED;
+    }
+
+    size_t remaining = len - offset;
+    if (remaining >= sizeof(servingPrefix) - 1 && memcmp(&in[offset], servingPrefix, sizeof(servingPrefix) - 1) == 0) {
+        return parseServing(in, len, parser);
+    }
+    if (remaining >= sizeof(neighborPrefix) - 1 && memcmp(&in[offset], neighborPrefix, sizeof(neighborPrefix) - 1) == 0) {
+        return parseNeighbor(in, len, parser);
+    }
+    return SYSTEM_ERROR_NOT_SUPPORTED;
 }
 
-void QuectelTowerRK::TowerInfo::log(const char *msg, LogLevel level) {
+void QuectelTowerRK::TowerInfo::log(const char *msg, LogLevel level) const {
     _log.log(level, "%s: serving %s", msg, serving.toString().c_str());
     for(auto it = neighbors.begin(); it != neighbors.end(); ++it) {
         _log.log(level, " neighbor %s", (*it).toString().c_str());
@@ -431,9 +1684,17 @@ void QuectelTowerRK::TowerInfo::log(const char *msg, LogLevel level) {
 void QuectelTowerRK::TowerInfo::clear() {
     serving.clear();
     neighbors.clear();
+    neighborsDiscarded = 0;
+    memset(neighborTable, 0, sizeof(neighborTable));
+    neighborTableCount = 0;
+    status = ScanStatus::NONE;
+    contents = ScanOptions::NONE;
+    updatedMs = 0;
+    neighborsUpdatedMs = 0;
+    neighborsReused = false;
 }
 
-QuectelTowerRK::TowerInfo &QuectelTowerRK::TowerInfo::toJsonWriter(JSONWriter &writer, int numToInclude) {
+const QuectelTowerRK::TowerInfo &QuectelTowerRK::TowerInfo::toJsonWriter(JSONWriter &writer, int numToInclude) const {
     int numAdded = 0;
 
     writer.beginArray();
@@ -441,12 +1702,20 @@ QuectelTowerRK::TowerInfo &QuectelTowerRK::TowerInfo::toJsonWriter(JSONWriter &w
         serving.toJsonWriter(writer);
         numAdded++;
     }
-    for(auto it = neighbors.begin(); it != neighbors.end(); ++it) {
-        if (numToInclude != 0 && numAdded >= numToInclude) {
-            break;
+    if (numToInclude != 0 && (size_t)(numToInclude - numAdded) < neighbors.size()) {
+        // Not all will fit, so include the strongest
+        InlineVector<uint16_t, MAX_NEIGHBORS> indexes;
+        if (numToInclude > numAdded) {
+            getStrongestNeighbors(indexes, numToInclude - numAdded);
+        }
+        for(uint16_t index : indexes) {
+            neighbors[index].toJsonWriter(writer);
+        }
+    }
+    else {
+        for(auto it = neighbors.begin(); it != neighbors.end(); ++it) {
+            (*it).toJsonWriter(writer);
         }
-        (*it).toJsonWriter(writer);
-        numAdded++;
     }
 
     writer.endArray();
@@ -454,31 +1723,474 @@ QuectelTowerRK::TowerInfo &QuectelTowerRK::TowerInfo::toJsonWriter(JSONWriter &w
     return *this;
 }
 
-#ifdef SYSTEM_VERSION_v620
-QuectelTowerRK::TowerInfo &QuectelTowerRK::TowerInfo::toVariant(Variant &obj, int numToInclude) {
-    int numAdded = 0;
+size_t QuectelTowerRK::TowerInfo::selectTowers(size_t maxBytes, TowerSelection &selection) const {
+    selection = TowerSelection();
+
+    // A JSONBufferWriter with no buffer counts the bytes without storing them
+    auto encodedSize = [](const auto &tower) {
+        JSONBufferWriter writer(nullptr, 0);
+        tower.toJsonWriter(writer);
+        return writer.dataSize();
+    };
+
+    // Brackets, then a comma before each tower after the first
+    size_t size = 2;
+    auto tryAdd = [&](size_t towerSize) {
+        size_t newSize = size + towerSize + ((selection.numTowers() != 0) ? 1 : 0);
+        if (newSize > maxBytes) {
+            selection.towersOmitted++;
+            return false;
+        }
+        size = newSize;
+        return true;
+    };
 
     if (serving.rat != RadioAccessTechnology::NONE) {
-        Variant obj2;
-        serving.toVariant(obj2);
-        obj.append(obj2);
-        numAdded++;
+        selection.includeServing = tryAdd(encodedSize(serving));
+        if (!selection.includeServing) {
+            // Neighbors alone don't identify the location, so don't send them without the serving cell
+            selection.towersOmitted += neighbors.size();
+            return 0;
+        }
     }
-    for(auto it = neighbors.begin(); it != neighbors.end(); ++it) {
-        if (numToInclude != 0 && numAdded >= numToInclude) {
-            break;
+    InlineVector<uint16_t, MAX_NEIGHBORS> indexes;
+    getStrongestNeighbors(indexes);
+    for(uint16_t index : indexes) {
+        if (tryAdd(encodedSize(neighbors[index]))) {
+            selection.neighborIndexes.push_back(index);
+        }
+    }
+
+    selection.encodedSize = (size <= maxBytes) ? size : 0;
+    return selection.numTowers();
+}
+
+const QuectelTowerRK::TowerInfo &QuectelTowerRK::TowerInfo::toJsonWriter(JSONWriter &writer, const TowerSelection &selection) const {
+    writer.beginArray();
+    if (selection.includeServing) {
+        serving.toJsonWriter(writer);
+    }
+    for(uint16_t index : selection.neighborIndexes) {
+        if (index < neighbors.size()) {
+            neighbors[index].toJsonWriter(writer);
+        }
+    }
+    writer.endArray();
+
+    return *this;
+}
+
+#ifdef SYSTEM_VERSION_v620
+const QuectelTowerRK::TowerInfo &QuectelTowerRK::TowerInfo::toVariant(Variant &obj, const TowerSelection &selection) const {
+    // Each tower is filled in place in the array, instead of being built separately and then copied into it
+    VariantArray &array = obj.asArray();
+    array.reserve(array.size() + (int)selection.numTowers());
+
+    if (selection.includeServing) {
+        array.append(Variant());
+        serving.toVariant(array.last());
+    }
+    for(uint16_t index : selection.neighborIndexes) {
+        if (index < neighbors.size()) {
+            array.append(Variant());
+            neighbors[index].toVariant(array.last());
         }
-        Variant obj2;
-        (*it).toVariant(obj2);
-        obj.append(obj2);
-        numAdded++;
     }
 
     return *this;
 }
+
+const QuectelTowerRK::TowerInfo &QuectelTowerRK::TowerInfo::toVariant(Variant &obj, int numToInclude) const {
+    TowerSelection selection;
+
+    selection.includeServing = (serving.rat != RadioAccessTechnology::NONE);
+    int numAdded = selection.includeServing ? 1 : 0;
+    if (numToInclude != 0 && (size_t)(numToInclude - numAdded) < neighbors.size()) {
+        // Not all will fit, so include the strongest
+        if (numToInclude > numAdded) {
+            getStrongestNeighbors(selection.neighborIndexes, numToInclude - numAdded);
+        }
+    }
+    else {
+        for(size_t ii = 0; ii < neighbors.size(); ii++) {
+            selection.neighborIndexes.push_back((uint16_t)ii);
+        }
+    }
+
+    return toVariant(obj, selection);
+}
 #endif // SYSTEM_VERSION_v620
 
 
+int QuectelTowerRK::TowerInfo::toCbor(uint8_t *buf, size_t bufSize, int numToInclude) const {
+    QuectelTowerCbor::Writer writer(buf, bufSize);
+
+    // Array lengths come first in CBOR, so choose the neighbors before writing anything
+    bool includeServing = (serving.rat != RadioAccessTechnology::NONE);
+    InlineVector<uint16_t, MAX_NEIGHBORS> indexes;
+    int numNeighbors = (numToInclude != 0) ? numToInclude - (includeServing ? 1 : 0) : (int)neighbors.size();
+    if (numNeighbors >= (int)neighbors.size()) {
+        for(size_t ii = 0; ii < neighbors.size(); ii++) {
+            indexes.push_back((uint16_t)ii);
+        }
+    }
+    else if (numNeighbors > 0) {
+        getStrongestNeighbors(indexes, numNeighbors);
+    }
+
+    writer.beginArray((includeServing ? 1 : 0) + indexes.size());
+    if (includeServing) {
+        writer.beginMap(6);
+        writer.pair(QuectelTowerCbor::Key::Rat, (int)serving.rat);
+        writer.pair(QuectelTowerCbor::Key::Mcc, serving.mcc);
+        writer.pair(QuectelTowerCbor::Key::Mnc, serving.mnc);
+        writer.pair(QuectelTowerCbor::Key::Lac, serving.lac);
+        writer.pair(QuectelTowerCbor::Key::CellId, serving.cellId);
+        writer.pair(QuectelTowerCbor::Key::Str, serving.signalPower);
+    }
+    for(uint16_t index : indexes) {
+        const CellularNeighbor &neighbor = neighbors[index];
+        writer.beginMap(3);
+        writer.pair(QuectelTowerCbor::Key::NeighborId, neighbor.neighborId);
+        writer.pair(QuectelTowerCbor::Key::Channel, neighbor.earfcn);
+        writer.pair(QuectelTowerCbor::Key::Str, neighbor.signalPower);
+    }
+
+    if (writer.overflow()) {
+        return SYSTEM_ERROR_TOO_LARGE;
+    }
+    return (int)writer.getSize();
+}
+
+int QuectelTowerRK::TowerInfo::fromCbor(const uint8_t *buf, size_t size) {
+    clear();
+
+    bool success = QuectelTowerCbor::decode(buf, size, [this](const QuectelTowerCbor::Tower &tower) {
+        if (tower.isServing) {
+            serving.rat = (RadioAccessTechnology)tower.rat;
+            serving.mcc = tower.mcc;
+            serving.mnc = tower.mnc;
+            serving.lac = tower.lac;
+            serving.cellId = tower.cellId;
+            serving.signalPower = tower.signalPower;
+            return true;
+        }
+
+        CellularNeighbor neighbor;
+        neighbor.neighborId = tower.neighborId;
+        neighbor.earfcn = tower.channel;
+        neighbor.signalPower = tower.signalPower;
+        return neighbors.push_back(neighbor);
+    });
+    if (!success) {
+        clear();
+        return SYSTEM_ERROR_BAD_DATA;
+    }
+
+    RadioAccessTechnology neighborRat = serving.isValid() ? serving.rat : RadioAccessTechnology::LTE;
+    for(CellularNeighbor &neighbor : neighbors) {
+        neighbor.rat = neighborRat;
+    }
+    return SYSTEM_ERROR_NONE;
+}
+
 bool QuectelTowerRK::TowerInfo::isValid() const {
     return serving.isValid();
 }
+
+int QuectelTowerRK::TowerInfo::findNeighbor(uint32_t earfcn, uint32_t neighborId) const {
+    for(size_t ii = 0; ii < neighbors.size(); ii++) {
+        if (neighbors[ii].earfcn == earfcn && neighbors[ii].neighborId == neighborId) {
+            return (int)ii;
+        }
+    }
+    return -1;
+}
+
+
+void QuectelTowerRK::TowerInfo::getStrongestNeighbors(InlineVector<uint16_t, MAX_NEIGHBORS> &indexes, size_t maxCount) const {
+    indexes.clear();
+    for(size_t ii = 0; ii < neighbors.size(); ii++) {
+        indexes.push_back((uint16_t)ii);
+    }
+    if (maxCount == 0 || maxCount > indexes.size()) {
+        maxCount = indexes.size();
+    }
+
+    // Comparing the index last makes this a total order, so equal signals keep their modem order
+    auto stronger = [this](uint16_t a, uint16_t b) {
+        const CellularNeighbor &na = neighbors[a];
+        const CellularNeighbor &nb = neighbors[b];
+        if (na.signalPower != nb.signalPower) {
+            return na.signalPower > nb.signalPower;
+        }
+        if (na.signalQuality != nb.signalQuality) {
+            return na.signalQuality > nb.signalQuality;
+        }
+        return a < b;
+    };
+
+    if (maxCount < indexes.size()) {
+        std::nth_element(indexes.begin(), indexes.begin() + maxCount, indexes.end(), stronger);
+    }
+    std::sort(indexes.begin(), indexes.begin() + maxCount, stronger);
+
+    while(indexes.size() > maxCount) {
+        indexes.erase(indexes.size() - 1);
+    }
+}
+
+
+void QuectelTowerRK::TowerDelta::clear() {
+    servingChanged = servingSignalChanged = false;
+    serving.clear();
+    added.clear();
+    changed.clear();
+    removed.clear();
+}
+
+const QuectelTowerRK::TowerDelta &QuectelTowerRK::TowerDelta::compute(const TowerInfo &previous, const TowerInfo &current, int signalThreshold) {
+    clear();
+
+    if (!current.serving.isSameCell(previous.serving)) {
+        servingChanged = true;
+        serving = current.serving;
+    }
+    else if (current.serving.isValid() && abs(current.serving.signalPower - previous.serving.signalPower) >= signalThreshold) {
+        servingSignalChanged = true;
+        serving = current.serving;
+    }
+
+    for(const CellularNeighbor &neighbor : current.neighbors) {
+        int index = previous.findNeighbor(neighbor.earfcn, neighbor.neighborId);
+        if (index < 0) {
+            added.push_back(neighbor);
+        }
+        else if (abs(neighbor.signalPower - previous.neighbors[index].signalPower) >= signalThreshold) {
+            changed.push_back(neighbor);
+        }
+    }
+
+    for(const CellularNeighbor &neighbor : previous.neighbors) {
+        if (current.findNeighbor(neighbor.earfcn, neighbor.neighborId) < 0) {
+            removed.push_back(NeighborKey{neighbor.earfcn, neighbor.neighborId});
+        }
+    }
+
+    return *this;
+}
+
+int QuectelTowerRK::TowerDelta::apply(TowerInfo &towerInfo) const {
+    int result = SYSTEM_ERROR_NONE;
+
+    if (servingChanged) {
+        towerInfo.serving = serving;
+    }
+    else if (servingSignalChanged) {
+        towerInfo.serving.signalPower = serving.signalPower;
+    }
+
+    for(const NeighborKey &key : removed) {
+        int index = towerInfo.findNeighbor(key.earfcn, key.neighborId);
+        if (index >= 0) {
+            towerInfo.neighbors.erase((size_t)index);
+        }
+        else {
+            result = SYSTEM_ERROR_NOT_FOUND;
+        }
+    }
+
+    for(const CellularNeighbor &neighbor : changed) {
+        int index = towerInfo.findNeighbor(neighbor.earfcn, neighbor.neighborId);
+        if (index >= 0) {
+            towerInfo.neighbors[index] = neighbor;
+        }
+        else {
+            result = SYSTEM_ERROR_NOT_FOUND;
+        }
+    }
+
+    for(const CellularNeighbor &neighbor : added) {
+        towerInfo.addNeighbor(neighbor);
+    }
+
+    return result;
+}
+
+bool QuectelTowerRK::TowerDelta::isEmpty() const {
+    return !servingChanged && !servingSignalChanged && added.empty() && changed.empty() && removed.empty();
+}
+
+const QuectelTowerRK::TowerDelta &QuectelTowerRK::TowerDelta::toJsonWriter(JSONWriter &writer) const {
+    writer.beginObject();
+
+    if (servingChanged) {
+        writer.name("s").beginObject();
+        if (serving.isValid()) {
+            serving.toJsonWriter(writer, false);
+        }
+        writer.endObject();
+    }
+    else if (servingSignalChanged) {
+        writer.name("ss").value(serving.signalPower);
+    }
+
+    // Arrays instead of objects to keep the delta small
+    const InlineVector<CellularNeighbor, MAX_NEIGHBORS> *lists[2] = {&added, &changed};
+    const char *listNames[2] = {"a", "c"};
+    for(size_t ii = 0; ii < 2; ii++) {
+        if (lists[ii]->empty()) {
+            continue;
+        }
+        writer.name(listNames[ii]).beginArray();
+        for(const CellularNeighbor &neighbor : *lists[ii]) {
+            writer.beginArray();
+            writer.value((unsigned)neighbor.neighborId);
+            writer.value((unsigned)neighbor.earfcn);
+            writer.value(neighbor.signalPower);
+            writer.endArray();
+        }
+        writer.endArray();
+    }
+
+    if (!removed.empty()) {
+        writer.name("r").beginArray();
+        for(const NeighborKey &key : removed) {
+            writer.beginArray();
+            writer.value((unsigned)key.neighborId);
+            writer.value((unsigned)key.earfcn);
+            writer.endArray();
+        }
+        writer.endArray();
+    }
+
+    writer.endObject();
+
+    return *this;
+}
+
+#ifdef SYSTEM_VERSION_v620
+const QuectelTowerRK::TowerDelta &QuectelTowerRK::TowerDelta::toVariant(Variant &obj) const {
+    // Like TowerInfo::toVariant(), each value is filled in place instead of being built separately and copied in
+    VariantMap &map = obj.asMap();
+    map.reserve(map.size() + 4);
+
+    if (servingChanged) {
+        Variant &servingObj = map["s"];
+        if (serving.isValid()) {
+            serving.toVariant(servingObj);
+        }
+        else {
+            servingObj.asMap();
+        }
+    }
+    else if (servingSignalChanged) {
+        map.set("ss", Variant(serving.signalPower));
+    }
+
+    const InlineVector<CellularNeighbor, MAX_NEIGHBORS> *lists[2] = {&added, &changed};
+    const char *listNames[2] = {"a", "c"};
+    for(size_t ii = 0; ii < 2; ii++) {
+        if (lists[ii]->empty()) {
+            continue;
+        }
+        VariantArray &array = map[listNames[ii]].asArray();
+        array.reserve(array.size() + (int)lists[ii]->size());
+        for(const CellularNeighbor &neighbor : *lists[ii]) {
+            array.append(Variant());
+            VariantArray &entry = array.last().asArray();
+            entry.reserve(3);
+            entry.append(Variant((unsigned)neighbor.neighborId));
+            entry.append(Variant((unsigned)neighbor.earfcn));
+            entry.append(Variant(neighbor.signalPower));
+        }
+    }
+
+    if (!removed.empty()) {
+        VariantArray &array = map["r"].asArray();
+        array.reserve(array.size() + (int)removed.size());
+        for(const NeighborKey &key : removed) {
+            array.append(Variant());
+            VariantArray &entry = array.last().asArray();
+            entry.reserve(2);
+            entry.append(Variant((unsigned)key.neighborId));
+            entry.append(Variant((unsigned)key.earfcn));
+        }
+    }
+
+    return *this;
+}
+#endif // SYSTEM_VERSION_v620
+
+
+void QuectelTowerRK::QengLineAssembler::reset() {
+    state = State::LineStart;
+    lineLen = 0;
+}
+
+void QuectelTowerRK::QengLineAssembler::feed(const char *buf, size_t len, TowerInfo &towerInfo) {
+    for(size_t ii = 0; ii < len; ii++) {
+        char c = buf[ii];
+        bool lineEnd = (c == '\r' || c == '\n' || c == 0);
+
+        switch(state) {
+            case State::LineStart:
+                if (!lineEnd) {
+                    lineBuf[0] = c;
+                    lineLen = 1;
+                    state = State::InLine;
+                }
+                break;
+
+            case State::InLine:
+                if (lineEnd) {
+                    processLine(towerInfo);
+                    state = State::LineStart;
+                }
+                else if (lineLen < sizeof(lineBuf)) {
+                    lineBuf[lineLen++] = c;
+                }
+                else {
+                    _log.trace("discarding long line");
+                    state = State::Discard;
+                }
+                break;
+
+            case State::Discard:
+                if (lineEnd) {
+                    state = State::LineStart;
+                }
+                break;
+        }
+    }
+}
+
+void QuectelTowerRK::QengLineAssembler::flush(TowerInfo &towerInfo) {
+    if (state == State::InLine) {
+        processLine(towerInfo);
+    }
+    reset();
+}
+
+void QuectelTowerRK::QengLineAssembler::processLine(TowerInfo &towerInfo) {
+    static const char prefix[] = "+QENG:";
+    const size_t prefixLen = sizeof(prefix) - 1;
+
+    // The line may contain more than one response if the line terminator was lost, or
+    // may have stray characters before the prefix. Each +QENG: starts a new response.
+    const QengParser &lineParser = parser ? *parser : getDetectedQengParser();
+    const char *start = nullptr;
+    for(size_t ii = 0; ii + prefixLen <= lineLen; ii++) {
+        if (lineBuf[ii] == '+' && memcmp(&lineBuf[ii], prefix, prefixLen) == 0) {
+            if (start) {
+                towerInfo.parseLine(start, &lineBuf[ii] - start, lineParser);
+            }
+            start = &lineBuf[ii];
+            ii += prefixLen - 1;
+        }
+    }
+    if (start) {
+        towerInfo.parseLine(start, &lineBuf[lineLen] - start, lineParser);
+    }
+    lineLen = 0;
+}
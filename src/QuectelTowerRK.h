@@ -26,7 +26,18 @@
 
 #include "Particle.h"
 
-#include <vector>
+#include <atomic>
+
+/**
+ * @brief Maximum number of neighbor cells stored in a TowerInfo object
+ * 
+ * You can override this by defining it before including this file, or in your project build flags.
+ * Each neighbor takes 28 bytes in every TowerInfo object, and the worker thread stack grows by the
+ * same amount (see THREAD_STACK_SIZE).
+ */
+#ifndef QUECTELTOWERRK_MAX_NEIGHBORS
+#define QUECTELTOWERRK_MAX_NEIGHBORS 16
+#endif
 
 /**
  * @brief Class to grab cellular modem and tower information from Quectel cellular modems on Particle devices
@@ -51,17 +62,75 @@ public:
      */
     static constexpr system_tick_t PERIOD_ERROR_MS {10000};
 
+    /**
+     * @brief Longest retry period after repeated failures (milliseconds)
+     * 
+     * After each consecutive failure of the signal poll or a scan, the retry period starting at 
+     * PERIOD_ERROR_MS is doubled, up to this limit, plus up to 25% random jitter.
+     */
+    static constexpr system_tick_t BACKOFF_MAX_MS {5 * 60 * 1000};
+
+    /**
+     * @brief Number of commands that can be queued for the worker thread
+     */
+    static constexpr size_t COMMAND_QUEUE_SIZE {4};
+
+    /**
+     * @brief Time budget for a scan request that does not specify one (milliseconds)
+     * 
+     * This is the same as the previous fixed limit of two 10 second AT commands.
+     */
+    static constexpr unsigned long SCAN_TIMEOUT_DEFAULT_MS {20000};
+
+    /**
+     * @brief Maximum timeout for a single AT+QENG command (milliseconds)
+     */
+    static constexpr unsigned long COMMAND_TIMEOUT_MAX_MS {10000};
+
+    /**
+     * @brief An AT+QENG command is not started if less than this is left in the scan budget (milliseconds)
+     */
+    static constexpr unsigned long COMMAND_TIMEOUT_MIN_MS {500};
+
+    /**
+     * @brief Part of the scan budget reserved for delivering the result (milliseconds)
+     * 
+     * This keeps the result ahead of a scanBlocking() timeout that uses the same budget.
+     */
+    static constexpr unsigned long DEADLINE_MARGIN_MS {100};
+
+    /**
+     * @brief Maximum number of callbacks that can be waiting for the same scan
+     */
+    static constexpr size_t MAX_SCAN_SUBSCRIBERS {8};
+
+    /**
+     * @brief Maximum number of neighbor cells stored in a TowerInfo object
+     */
+    static constexpr size_t MAX_NEIGHBORS {QUECTELTOWERRK_MAX_NEIGHBORS};
+
     /**
      * @brief Cell updates need to be at least this often or flagged as an error
      */
     static constexpr unsigned int DEFAULT_MAX_AGE_SEC {10};
 
+    /**
+     * @brief Default for withTowerInfoMaxAge(), how old a saved scan can be for addToEventHandler to use it (milliseconds)
+     */
+    static constexpr unsigned long DEFAULT_TOWER_INFO_MAX_AGE_MS {60000};
+
+    /**
+     * @brief Default for withEventHandlerNonBlocking(), the oldest saved scan addToEventHandler will attach (milliseconds)
+     */
+    static constexpr unsigned long DEFAULT_EVENT_HANDLER_MAX_STALENESS_MS {15 * 60 * 1000};
+
     /**
      * @brief Commands to instruct cellular thread, used internally
      */
     enum class CommandCode {
         None,                   /**< Do nothing */
         Measure,                /**< Perform cellular scan */
+        RefreshSignal,          /**< Update the signal strength (on-demand mode) */
         Exit,                   /**< Exit from thread */
     };
 
@@ -75,6 +144,48 @@ public:
         LTE_NB_IOT = 9 //!< LET Cat NB1 (NBIoT)
     };
 
+    /**
+     * @brief Neighbor cell type, from the qualifier in the AT+QENG="neighbourcell" response
+     */
+    enum class NeighborType : uint8_t {
+        UNKNOWN, //!< Not set or not known
+        INTRA, //!< Intra-frequency, same EARFCN as the serving cell ("neighbourcell intra")
+        INTER, //!< Inter-frequency, different EARFCN than the serving cell ("neighbourcell inter")
+    };
+
+    /**
+     * @brief Quectel modem family, which determines the field layout of AT+QENG responses
+     */
+    enum class ModemFamily {
+        UNKNOWN, //!< Not detected yet, uses the BG95/BG96 layout
+        BG95, //!< BG95 (M-SoM, B504e, Monitor One)
+        BG96, //!< BG96 (Tracker SoM)
+        EG91, //!< EG91 (Tracker SoM, B524, M-SoM)
+        EG21, //!< EG21
+    };
+
+    /**
+     * @brief Where the signal strength returned by getSignal() comes from
+     */
+    enum class SignalSource {
+        RSSI, //!< Call Cellular.RSSI() (default)
+        SERVING_CELL, //!< Use the RSRP and RSRQ from AT+QENG="servingcell", from scans or a serving cell only poll
+    };
+
+    class CellularServing;
+    class CellularNeighbor;
+
+    /**
+     * @brief Parser functions for the AT+QENG responses of a modem family
+     * 
+     * These are generated at compile time from a field schema table for each modem family.
+     * Use getQengParser() to get the parser for a specific family.
+     */
+    struct QengParser {
+        int (*parseServing)(CellularServing &serving, const char *in, size_t len); //!< Parse a servingcell response
+        int (*parseNeighbor)(CellularNeighbor &neighbor, const char *in, size_t len); //!< Parse a neighbourcell response
+    };
+
     /**
      * @brief Information identifying the serving tower
      * 
@@ -87,9 +198,27 @@ public:
         unsigned int mnc {0};       //!< Mobile Network Code 0-999
         uint32_t cellId {0};        //!< Cell identifier 28-bits
         unsigned int lac {0};       //!< Location area code 16-bits
-        int signalPower {0};        //!< Signal power
+        int signalPower {0};        //!< Signal power (RSRP in dBm)
+
+        bool tdd {false};           //!< true if TDD, false if FDD
+        uint16_t pci {0};           //!< Physical cell ID 0-503
+        uint32_t earfcn {0};        //!< E-UTRA absolute radio frequency channel number
+        uint16_t band {0};          //!< Frequency band indicator
+        uint8_t ulBandwidth {0};    //!< Uplink bandwidth index (0 = 1.4 MHz, 1 = 3, 2 = 5, 3 = 10, 4 = 15, 5 = 20 MHz)
+        uint8_t dlBandwidth {0};    //!< Downlink bandwidth index (same encoding as ulBandwidth)
+        int16_t rsrp {VALUE_NOT_AVAILABLE};     //!< Reference signal received power (dBm)
+        int16_t rsrq {VALUE_NOT_AVAILABLE};     //!< Reference signal received quality (dB)
+        int16_t rssi {VALUE_NOT_AVAILABLE};     //!< Received signal strength indicator (dBm)
+        int16_t sinr {VALUE_NOT_AVAILABLE};     //!< Signal to interference plus noise ratio, as reported by the modem
+        int16_t srxlev {VALUE_NOT_AVAILABLE};   //!< Cell selection RX level value (dB)
+
+        /**
+         * @brief Value used for rsrp, rsrq, rssi, sinr, and srxlev when the modem did not report the value
+         * 
+         * Some modems report "-" for fields that are not available in the current state.
+         */
+        static constexpr int16_t VALUE_NOT_AVAILABLE {INT16_MIN};
 
-        
         /**
          * @brief Convert this object to a readable string
          * 
@@ -102,18 +231,18 @@ public:
          * 
          * @param writer JSONWriter to write the data to
          * @param wrapInObject true to wrap the data with writer.beginObject() and writer.endObject(). Default = true.
-         * @return CellularServing& 
+         * @return const CellularServing& 
          */
-        CellularServing &toJsonWriter(JSONWriter &writer, bool wrapInObject = true);
+        const CellularServing &toJsonWriter(JSONWriter &writer, bool wrapInObject = true) const;
 
 #ifdef SYSTEM_VERSION_v620
         /**
          * @brief Save this data in a Variant object. Requires Device OS 6.2.0 or later.
          * 
          * @param obj Variant object to add to
-         * @return CellularServing& 
+         * @return const CellularServing& 
          */
-        CellularServing &toVariant(Variant &obj);
+        const CellularServing &toVariant(Variant &obj) const;
 #endif // SYSTEM_VERSION_v620
 
         /**
@@ -121,6 +250,13 @@ public:
          */
         void clear();
 
+        /**
+         * @brief Returns true if other is the same cell (RAT, MCC, MNC, LAC, and cell ID). Signal values are not compared.
+         * 
+         * @param other Serving cell to compare to
+         */
+        bool isSameCell(const CellularServing &other) const;
+
         /**
          * @brief Parse the results of an AT+QENG serving cell request
          * 
@@ -129,6 +265,18 @@ public:
          */
         int parse(const char *in);
 
+        /**
+         * @brief Parse the results of an AT+QENG serving cell request
+         * 
+         * @param in Response line, does not need to be null terminated
+         * @param len Length of the response line in bytes
+         * @return int 
+         * 
+         * This uses the field layout of the modem family detected at startup, from getDetectedQengParser().
+         * Use getQengParser() for a specific modem.
+         */
+        int parse(const char *in, size_t len);
+
         /**
          * @brief Returns true if the object appears to contain valid data.
          * 
@@ -138,6 +286,14 @@ public:
          * This just checks the RAT to make sure it's not NONE.
          */
         bool isValid() const;
+
+        /**
+         * @brief Returns true if the RSRQ, RSSI, and SINR were reported by the modem
+         * 
+         * @return true 
+         * @return false 
+         */
+        bool hasQuality() const;
     };
 
     /**
@@ -152,6 +308,7 @@ public:
         int signalQuality {0};      //!< Signal quality
         int signalPower {0};        //!< Signal power
         int signalStrength {0};     //!< Signal strength
+        NeighborType type {NeighborType::UNKNOWN}; //!< Intra-frequency or inter-frequency
 
         /**
          * @brief Convert this object to a readable string
@@ -165,18 +322,18 @@ public:
          * 
          * @param writer JSONWriter to write the data to
          * @param wrapInObject true to wrap the data with writer.beginObject() and writer.endObject(). Default = true.
-         * @return CellularServing& 
+         * @return const CellularNeighbor& 
          */
-        CellularNeighbor &toJsonWriter(JSONWriter &writer, bool wrapInObject = true);
+        const CellularNeighbor &toJsonWriter(JSONWriter &writer, bool wrapInObject = true) const;
 
 #ifdef SYSTEM_VERSION_v620
         /**
          * @brief Save this data in a Variant object. Requires Device OS 6.2.0 or later.
          * 
          * @param obj Variant object to add to
-         * @return CellularNeighbor& 
+         * @return const CellularNeighbor& 
          */
-        CellularNeighbor &toVariant(Variant &obj);
+        const CellularNeighbor &toVariant(Variant &obj) const;
 #endif // SYSTEM_VERSION_v620
 
         /**
@@ -192,6 +349,18 @@ public:
          */
         int parse(const char *in);
 
+        /**
+         * @brief Parse the results of an AT+QENG neighbor cells request
+         * 
+         * @param in Response line, does not need to be null terminated
+         * @param len Length of the response line in bytes
+         * @return int 
+         * 
+         * This uses the field layout of the modem family detected at startup, from getDetectedQengParser().
+         * Use getQengParser() for a specific modem.
+         */
+        int parse(const char *in, size_t len);
+
         /**
          * @brief Returns true if the object appears to contain valid data.
          * 
@@ -204,239 +373,1209 @@ public:
     };
 
     /**
-     * @brief Container for serving tower and neighbor tower information
+     * @brief Fixed-capacity array with a vector-like interface that stores its elements inline
+     * 
+     * @tparam T Element type, which should be trivially copyable
+     * @tparam N Maximum number of elements
+     * 
+     * This never allocates from the heap, and is trivially copyable if T is.
      */
-    class TowerInfo {
+    template<typename T, size_t N>
+    class InlineVector {
     public:
-        TowerInfo(); //!< Default constructor
-        virtual ~TowerInfo(); //!< Destructor
+        /**
+         * @brief Number of elements currently stored
+         */
+        size_t size() const { return count; }
 
         /**
-         * @brief You can construct an object as a copy of another object. This is a deep copy.
-         * 
-         * @param other 
-         * 
-         * After copying, changes to the other object have no effect on this object. Also the other object
-         * can be deleted, if desired.
+         * @brief Maximum number of elements that can be stored
          */
-        TowerInfo(const TowerInfo &other);
+        static constexpr size_t capacity() { return N; }
 
         /**
-         * @brief Copy another object into this object. This is a deep copy.
-         * 
-         * @param other 
-         * 
-         * The previous contents of this object are cleared first; this does not merge data.
+         * @brief Returns true if there are no elements
          */
-        TowerInfo &operator=(const TowerInfo &other);
+        bool empty() const { return count == 0; }
 
         /**
-         * @brief Clear the object to default values with no neighbors
+         * @brief Returns true if no more elements can be added
          */
-        void clear();
+        bool full() const { return count >= N; }
 
         /**
-         * @brief Parse the results of an AT+QENG serving cell request
-         * 
-         * @param in 
-         * @return int 
+         * @brief Remove all elements
          */
-        int parseServing(const char *in);
+        void clear() { count = 0; }
 
         /**
-         * @brief Parse the results of an AT+QENG neighbor cells request
+         * @brief Add an element to the end
          * 
-         * @param in 
-         * @return int 
+         * @param value Element to add
+         * @return true if added, false if the container is full
          */
-        int parseNeighbor(const char *in);
+        bool push_back(const T &value) {
+            if (count >= N) {
+                return false;
+            }
+            items[count++] = value;
+            return true;
+        }
 
         /**
-         * @brief Log the information to the debugging log
+         * @brief Remove the element at index, moving the following elements down
          * 
-         * @param msg A message to write before the serving cell
-         * @param level Logging level. Default is LOG_LEVEL_TRACE. LOG_LEVEL_INFO is another common option.
+         * @param index Index to remove, must be less than size()
          */
-        void log(const char *msg, LogLevel level = LOG_LEVEL_TRACE);
+        void erase(size_t index) {
+            if (index < count) {
+                for(size_t ii = index + 1; ii < count; ii++) {
+                    items[ii - 1] = items[ii];
+                }
+                count--;
+            }
+        }
+
+        T &at(size_t index) { return items[index]; } //!< Element at index, must be less than size()
+        const T &at(size_t index) const { return items[index]; } //!< Element at index, must be less than size()
+        T &operator[](size_t index) { return items[index]; } //!< Element at index, must be less than size()
+        const T &operator[](size_t index) const { return items[index]; } //!< Element at index, must be less than size()
 
+        T *begin() { return &items[0]; } //!< Iterator to the first element
+        T *end() { return &items[count]; } //!< Iterator past the last element
+        const T *begin() const { return &items[0]; } //!< Iterator to the first element
+        const T *end() const { return &items[count]; } //!< Iterator past the last element
+
+    protected:
+        T items[N]; //!< Element storage
+        size_t count = 0; //!< Number of elements in use
+    };
+
+    /**
+     * @brief A value protected by a sequence lock, for one writer thread and any number of readers
+     * 
+     * @tparam T Value type, which must be copyable without side effects (trivially copyable, or only
+     * plain data members and a vtable pointer)
+     * 
+     * Readers never block and never take a mutex. A reader copies the value and then checks
+     * that the sequence number did not change during the copy; if it did, the read is retried.
+     * The sequence number is odd while a write is in progress.
+     */
+    template<typename T>
+    class SeqLocked {
+    public:
         /**
-         * @brief Add the serving and neighbor towers to the writer in an array
+         * @brief Start modifying the value. Only one thread may write.
          * 
-         * @param writer 
-         * @param numToInclude Number of towers to add, or 0 for all
-         * @return TowerInfo& 
+         * @return T& Reference to the value, which can be modified until endWrite() is called
          */
-        TowerInfo &toJsonWriter(JSONWriter &writer, int numToInclude = 0);
+        T &beginWrite() {
+            seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            return value;
+        }
 
-#ifdef SYSTEM_VERSION_v620
         /**
-         * @brief Add the serving and neighbor towers to the Variant in an array. Requires Device OS 6.2.0 or later.
-         * 
-         * @param obj Variant array to add to
-         * @param numToInclude Number of towers to add, or 0 for all
-         * @return TowerInfo& 
+         * @brief Finish modifying the value, making it available to readers
          */
-        TowerInfo &toVariant(Variant &obj, int numToInclude = 0);
-#endif // SYSTEM_VERSION_v620
+        void endWrite() {
+            seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
 
         /**
-         * @brief Returns true if the object appears to contain valid data.
+         * @brief Try to copy a consistent snapshot of the value
          * 
-         * @return true 
-         * @return false 
-         * 
-         * This just checks the serving cell RAT to make sure it's not NONE.
+         * @param result Filled in with the value. May be modified even if false is returned.
+         * @return true if result is consistent, false if a write occurred and the read should be retried
          */
-        bool isValid() const;
+        bool tryRead(T &result) const {
+            uint32_t seq1 = seq.load(std::memory_order_acquire);
+            if (seq1 & 1) {
+                return false;
+            }
+            result = value;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return seq.load(std::memory_order_relaxed) == seq1;
+        }
 
         /**
-         * @brief The serving cell. This member is public.
+         * @brief Copy a consistent snapshot of the value, retrying if a write occurs during the copy
+         * 
+         * @param result Filled in with the value
          */
-        CellularServing serving;
+        void read(T &result) const {
+            while(!tryRead(result)) {
+            }
+        }
 
         /**
-         * @brief Vector of neighbor cells. This member is public.
+         * @brief Access the value from the writer thread, without copying
          * 
-         * You can use vector members on this, like size(), at(), and iter() to work with the results.
+         * Only the writer thread can safely use this, as it is the only thread that modifies the value.
          */
-        std::vector<CellularNeighbor> neighbors;
-    };
+        const T &writerValue() const { return value; }
 
-    /**
-     * @brief Scan for towers, blocking.
-     * 
-     * @param towerInfo Filled in with serving tower and neighboring tower information.
-     * @param timeoutMs How long to wait in milliseconds for a response (0 = wait forever). Default is 10 seconds.
-     * @return int 
-     * 
-     * This call can take as little as 20 milliseconds, but may take up to a few seconds if connected to cellular.
-     * It can block for longer if not connected to cellular as it will wait until connected.
-     */
-    int scanBlocking(TowerInfo &towerInfo, unsigned long timeoutMs = 10000);
+    protected:
+        std::atomic<uint32_t> seq {0}; //!< Sequence number, odd while a write is in progress
+        T value {}; //!< The protected value
+    };
 
     /**
-     * @brief Asynchronous scan for cellular towers with callback function
-     * 
-     * @param scanCallback Callback function to call when complete
-     * @retval SYSTEM_ERROR_NONE Success
-     * @retval SYSTEM_ERROR_BUSY Cannot start a new scan
-     * 
-     * The callback function is only called if the return value is SYSTEM_ERROR_NONE. It is called from
-     * a separate worker thread.
-     * 
-     * Callback function prototype for a C++ function or lambda:
-     * 
-     * void callback(TowerInfo towerInfo)
-     * 
-     * This call can take as little as 20 milliseconds, but may take up to a few seconds if connected to cellular.
-     * It can take for longer if not connected to cellular as it will wait until connected.
+     * @brief Cellular signal strength and quality with the time it was measured
      */
-    int scanWithCallback(std::function<void(TowerInfo towerInfo)> scanCallback);
+    class SignalSnapshot {
+    public:
+        CellularSignal signal; //!< Signal strength and quality
+        uint64_t updatedMs {0}; //!< System.millis() when measured, or 0 if there is no valid measurement
 
-    /**
-     * @brief Start scan for cellular towers
-     *
-     * @retval SYSTEM_ERROR_NONE Success
-     * @retval SYSTEM_ERROR_BUSY Cannot start a new scan
-     * 
-     * This is a low-level function; you'd typically use scanBlocking() or scanWithCallback().
-     */
-    int startScan();
+        /**
+         * @brief Returns true if the snapshot contains a valid measurement
+         */
+        bool isValid() const { return updatedMs != 0; }
 
-    /**
-     * @brief This method makes sure the callback is not called 
-     * 
-     * It's used internally by scanBlocking but if you are using scanWithCallback you can also
-     * use this to cancel the pending callback. 
-     */
-    void cancelScan();
+        /**
+         * @brief Returns the age of the measurement in milliseconds. Only meaningful if isValid().
+         */
+        uint64_t getAgeMs() const { return System.millis() - updatedMs; }
+    };
 
     /**
-     * @brief Get the cellular signal strength
-     *
-     * @param[out] signal Object with signal strength values
-     * @param[in] max_age How old a measurement can be to be valid
-     * @retval 0 Success
-     * @retval -ENODATA Measurement is old
+     * @brief What a scan requests from the modem. These are bit flags that can be combined with |.
      */
-    int getSignal(CellularSignal &signal, unsigned int max_age=DEFAULT_MAX_AGE_SEC);
+    enum class ScanOptions : uint8_t {
+        NONE = 0x00,        //!< Nothing
+        SERVING = 0x01,     //!< Serving cell (AT+QENG="servingcell")
+        NEIGHBORS = 0x02,   //!< Neighbor cells (AT+QENG="neighbourcell")
+        ALL = 0x03          //!< Serving and neighbor cells (default)
+    };
 
     /**
-     * @brief Get the signal strength age
-     *
-     * @return unsigned int Age in seconds
+     * @brief Combine ScanOptions flags
      */
-    unsigned int getSignalUpdate();
+    friend constexpr ScanOptions operator|(ScanOptions a, ScanOptions b) { return (ScanOptions)((uint8_t)a | (uint8_t)b); }
 
     /**
-     * @brief Get the most recently retrieved tower information
-     * 
-     * @param towerInfo 
-     * 
-     * This returns the last saved value and does not scan again. See scanBlocking and scanWithCallback.
+     * @brief Mask ScanOptions flags
      */
-    void getTowerInfo(TowerInfo &towerInfo);
+    friend constexpr ScanOptions operator&(ScanOptions a, ScanOptions b) { return (ScanOptions)((uint8_t)a & (uint8_t)b); }
 
     /**
-     * @brief Lock object
-     *
+     * @brief Returns true if all of the flags in option are set in options
      */
-    inline void lock() {mutex.lock();}
+    static constexpr bool hasScanOption(ScanOptions options, ScanOptions option) { return (options & option) == option; }
 
     /**
-     * @brief Unlock object
-     *
+     * @brief How a scan finished
      */
-    inline void unlock() {mutex.unlock();}
+    enum class ScanStatus : uint8_t {
+        NONE = 0,       //!< No scan has been done
+        COMPLETE,       //!< All of the requested data was received. A neighbourcell ERROR after a serving cell is an empty neighbor list.
+        PARTIAL,        //!< Some of the requested data was received, the rest failed or ran out of time
+        TIMEOUT,        //!< Ran out of time before receiving any data. Not saved, see getTowerInfo().
+        FAILED,         //!< The modem returned an error and no data was received. Not saved, see getTowerInfo().
+        BACKOFF         //!< Recent scans failed, so the modem was not queried until the backoff period ends. See getModemHealth().
+    };
 
-#ifdef SYSTEM_VERSION_v620
     /**
-     * @brief Handler function used with the LocationFusionRK library
+     * @brief Failure tracking for the AT commands sent by the worker thread
      * 
-     * @param eventData 
-     * @param locVariant 
+     * Result codes are the return value of Cellular.command() (RESP_OK, RESP_ERROR, WAIT), 
+     * or a SYSTEM_ERROR code. Cellular.RSSI() failures are SYSTEM_ERROR_UNKNOWN.
      */
-    static void addToEventHandler(Variant &eventData, Variant &locVariant);
-#endif // SYSTEM_VERSION_v620
+    class ModemHealth {
+    public:
+        uint16_t signalFailures {0}; //!< Consecutive failed signal polls
+        uint16_t scanFailures {0}; //!< Consecutive failed scans
+        int lastSignalResult {0}; //!< Result of the last signal poll, 0 (SYSTEM_ERROR_NONE) on success
+        int lastScanResult {0}; //!< Result of the last scan, 0 (SYSTEM_ERROR_NONE) on success
+        uint64_t lastSignalSuccessMs {0}; //!< System.millis() of the last successful signal poll, or 0 if none
+        uint64_t lastScanSuccessMs {0}; //!< System.millis() of the last successful scan, or 0 if none
+        uint64_t scanBackoffUntilMs {0}; //!< System.millis() before which scans return ScanStatus::BACKOFF
 
+        /**
+         * @brief Returns true if the last signal poll and the last scan did not fail
+         */
+        bool isHealthy() const { return signalFailures == 0 && scanFailures == 0; }
+    };
 
     /**
-     * @brief Parse a AT+QENG RAT string to convert it to a RadioAccessTechnology value (an int).
-     * 
-     * @param str 
-     * @return RadioAccessTechnology 
+     * @brief The towers chosen by TowerInfo::selectTowers() to fit in a size limit
      */
-    static RadioAccessTechnology parseRadioAccessTechnology(const char *str);
+    class TowerSelection {
+    public:
+        /**
+         * @brief Returns the number of towers selected, including the serving cell
+         */
+        size_t numTowers() const { return (includeServing ? 1 : 0) + neighborIndexes.size(); }
 
-    /**
-     * @brief Singleton class instance access for QuectelTowerRK
-     *
-     * @return QuectelTowerRK&
-     */
-    static QuectelTowerRK &instance()
-    {
-        if(!_instance)
-        {
-            _instance = new QuectelTowerRK();
-        }
-        return *_instance;
-    }
+        bool includeServing {false}; //!< true if the serving cell is included
+        InlineVector<uint16_t, MAX_NEIGHBORS> neighborIndexes; //!< Indexes into TowerInfo::neighbors of the neighbors included, in order
+        size_t encodedSize {0}; //!< Size of the JSON array in bytes, not including a null terminator
+        size_t towersOmitted {0}; //!< Number of towers that did not fit
+    };
 
-private:
     /**
-     * @brief The constructor is private because the class is a singleton
+     * @brief Container for serving tower and neighbor tower information
      * 
-     * Use QuectelTowerRK::instance() to instantiate the singleton.
-     */
-    QuectelTowerRK();
-
-    /**
-     * @brief The destructor is private because the class is a singleton and cannot be deleted
+     * This object is trivially copyable and does not allocate memory, so it can be freely copied.
      */
-    virtual ~QuectelTowerRK();
+    class TowerInfo {
+    public:
+        TowerInfo() = default; //!< Default constructor
+        TowerInfo(const TowerInfo &other) = default; //!< Copy constructor, copies the inline data
+        TowerInfo(TowerInfo &&other) = default; //!< Move constructor, same as copy as there is no heap data
+        TowerInfo &operator=(const TowerInfo &other) = default; //!< Copy assignment, replaces the previous contents
+        TowerInfo &operator=(TowerInfo &&other) = default; //!< Move assignment, same as copy as there is no heap data
 
-    /**
-     * This class is a singleton and cannot be copied
+        /**
+         * @brief Clear the object to default values with no neighbors
+         */
+        void clear();
+
+        /**
+         * @brief Parse the results of an AT+QENG serving cell request
+         * 
+         * @param in 
+         * @return int 
+         */
+        int parseServing(const char *in);
+
+        /**
+         * @brief Parse the results of an AT+QENG serving cell request
+         * 
+         * @param in Response line, does not need to be null terminated
+         * @param len Length of the response line in bytes
+         * @return int 
+         * 
+         * This uses the parser from getDetectedQengParser().
+         */
+        int parseServing(const char *in, size_t len);
+
+        /**
+         * @brief Parse the results of an AT+QENG serving cell request using a modem-specific parser
+         * 
+         * @param in Response line, does not need to be null terminated
+         * @param len Length of the response line in bytes
+         * @param parser Parser for the modem family, from getQengParser()
+         * @return int 
+         */
+        int parseServing(const char *in, size_t len, const QengParser &parser);
+
+        /**
+         * @brief Parse the results of an AT+QENG neighbor cells request
+         * 
+         * @param in 
+         * @return int 
+         */
+        int parseNeighbor(const char *in);
+
+        /**
+         * @brief Parse the results of an AT+QENG neighbor cells request
+         * 
+         * @param in Response line, does not need to be null terminated
+         * @param len Length of the response line in bytes
+         * @return int 
+         * 
+         * This uses the parser from getDetectedQengParser().
+         */
+        int parseNeighbor(const char *in, size_t len);
+
+        /**
+         * @brief Parse the results of an AT+QENG neighbor cells request using a modem-specific parser
+         * 
+         * @param in Response line, does not need to be null terminated
+         * @param len Length of the response line in bytes
+         * @param parser Parser for the modem family, from getQengParser()
+         * @return int 
+         */
+        int parseNeighbor(const char *in, size_t len, const QengParser &parser);
+
+        /**
+         * @brief Parse a single AT+QENG response line of either the serving cell or neighbor cell type
+         * 
+         * @param in Response line, does not need to be null terminated
+         * @param len Length of the response line in bytes
+         * @return int SYSTEM_ERROR_NONE on success, SYSTEM_ERROR_NOT_SUPPORTED if not a +QENG line
+         * 
+         * This uses the parser from getDetectedQengParser().
+         */
+        int parseLine(const char *in, size_t len);
+
+        /**
+         * @brief Parse a single AT+QENG response line using a modem-specific parser
+         * 
+         * @param in Response line, does not need to be null terminated
+         * @param len Length of the response line in bytes
+         * @param parser Parser for the modem family, from getQengParser()
+         * @return int SYSTEM_ERROR_NONE on success, SYSTEM_ERROR_NOT_SUPPORTED if not a +QENG line
+         */
+        int parseLine(const char *in, size_t len, const QengParser &parser);
+
+        /**
+         * @brief Add a neighbor cell, applying the overflow policy if the neighbor list is full
+         * 
+         * @param neighbor The neighbor to add
+         * @return true if the neighbor was stored, false if it was discarded
+         * 
+         * A neighbor with the same RAT, EARFCN, and neighbor ID as one already stored is a duplicate (the 
+         * modem can list the same cell more than once). Only the one with the better signal is kept. A neighbor
+         * that is the serving cell (same RAT, EARFCN, and PCI) is discarded, so parse the serving cell first.
+         * 
+         * When there are already MAX_NEIGHBORS neighbors, the strongest neighbors (by signalPower) are kept.
+         * If the new neighbor is stronger than the weakest stored neighbor, it replaces it. Otherwise
+         * the new neighbor is discarded.
+         */
+        bool addNeighbor(const CellularNeighbor &neighbor);
+
+        /**
+         * @brief Find a neighbor cell by channel and neighbor ID
+         * 
+         * @param earfcn Channel (EARFCN)
+         * @param neighborId Neighbor ID (physical cell ID)
+         * @return int Index into neighbors, or -1 if not found
+         */
+        int findNeighbor(uint32_t earfcn, uint32_t neighborId) const;
+
+        /**
+         * @brief Get the indexes of the strongest neighbor cells, strongest first
+         * 
+         * @param[out] indexes Filled in with indexes into neighbors
+         * @param maxCount Maximum number of indexes to return, or 0 for all
+         * 
+         * Neighbors are ordered by signalPower (RSRP), then signalQuality (RSRQ). Neighbors with the same 
+         * values keep their modem order, so the result is stable. This uses a partial sort, so it's O(n) 
+         * plus O(k log k) for the k returned, and it does not allocate memory.
+         */
+        void getStrongestNeighbors(InlineVector<uint16_t, MAX_NEIGHBORS> &indexes, size_t maxCount = 0) const;
+
+        /**
+         * @brief Log the information to the debugging log
+         * 
+         * @param msg A message to write before the serving cell
+         * @param level Logging level. Default is LOG_LEVEL_TRACE. LOG_LEVEL_INFO is another common option.
+         */
+        void log(const char *msg, LogLevel level = LOG_LEVEL_TRACE) const;
+
+        /**
+         * @brief Add the serving and neighbor towers to the writer in an array
+         * 
+         * @param writer 
+         * @param numToInclude Number of towers to add, or 0 for all
+         * @return const TowerInfo& 
+         * 
+         * If numToInclude leaves out some of the neighbors, the strongest ones are included, strongest first.
+         */
+        const TowerInfo &toJsonWriter(JSONWriter &writer, int numToInclude = 0) const;
+
+        /**
+         * @brief Choose the towers to include so the JSON array fits in maxBytes
+         * 
+         * @param maxBytes Maximum size of the array in bytes, including the brackets
+         * @param[out] selection Filled in with the towers that fit and the size of the array
+         * @return size_t Number of towers selected
+         * 
+         * The encoded size of each tower is calculated exactly, without writing it. The serving cell is
+         * considered first, then the neighbors strongest first (see getStrongestNeighbors()). A neighbor that 
+         * does not fit is skipped, but a later, shorter one can still be included. Towers are never cut off
+         * in the middle.
+         * 
+         * Neighbors are only added after the serving cell. If there is a serving cell and it does not fit,
+         * nothing is selected: this returns 0 and selection.encodedSize is 0. Neighbors are only selected
+         * without a serving cell when this object has none.
+         * 
+         * Pass the selection to toJsonWriter() or toVariant(). Subtract the size of the rest of your event
+         * from the event size limit to get maxBytes.
+         */
+        size_t selectTowers(size_t maxBytes, TowerSelection &selection) const;
+
+        /**
+         * @brief Add the towers chosen by selectTowers() to the writer in an array
+         * 
+         * @param writer 
+         * @param selection From selectTowers() on this object
+         * @return const TowerInfo& 
+         */
+        const TowerInfo &toJsonWriter(JSONWriter &writer, const TowerSelection &selection) const;
+
+#ifdef SYSTEM_VERSION_v620
+        /**
+         * @brief Add the serving and neighbor towers to the Variant in an array. Requires Device OS 6.2.0 or later.
+         * 
+         * @param obj Variant array to add to
+         * @param numToInclude Number of towers to add, or 0 for all
+         * @return const TowerInfo& 
+         * 
+         * If numToInclude leaves out some of the neighbors, the strongest ones are included, strongest first.
+         */
+        const TowerInfo &toVariant(Variant &obj, int numToInclude = 0) const;
+
+        /**
+         * @brief Add the towers chosen by selectTowers() to the Variant in an array. Requires Device OS 6.2.0 or later.
+         * 
+         * @param obj Variant array to add to
+         * @param selection From selectTowers() on this object
+         * @return const TowerInfo& 
+         * 
+         * When the Variant is converted to JSON, the array is the size in selection.encodedSize.
+         */
+        const TowerInfo &toVariant(Variant &obj, const TowerSelection &selection) const;
+#endif // SYSTEM_VERSION_v620
+
+        /**
+         * @brief Encode the serving and neighbor towers as CBOR with integer keys
+         * 
+         * @param buf Buffer to write to
+         * @param bufSize Size of the buffer in bytes
+         * @param numToInclude Number of towers to add, or 0 for all. As with toJsonWriter(), the strongest neighbors are kept.
+         * @return int Number of bytes written, or SYSTEM_ERROR_TOO_LARGE if the buffer is too small
+         * 
+         * This is written directly to the buffer without allocating memory, and is usually about a third of the
+         * size of the JSON. The top level is an array of towers, in the same order as toJsonWriter(). Each tower is
+         * a map with these integer keys:
+         * 
+         * | Key | JSON name | Value |
+         * | :-- | :-------- | :---- |
+         * | 0 | rat | RadioAccessTechnology as an integer (serving cell only) |
+         * | 1 | mcc | Mobile Country Code (serving cell only) |
+         * | 2 | mnc | Mobile Network Code (serving cell only) |
+         * | 3 | lac | Location area code (serving cell only) |
+         * | 4 | cid | Cell ID (serving cell only) |
+         * | 5 | str | Signal power in dBm |
+         * | 6 | nid | Neighbor ID (neighbor cells only) |
+         * | 7 | ch | Channel (neighbor cells only) |
+         * 
+         * Use fromCbor() to decode it.
+         */
+        int toCbor(uint8_t *buf, size_t bufSize, int numToInclude = 0) const;
+
+        /**
+         * @brief Decode data from toCbor()
+         * 
+         * @param buf Data from toCbor()
+         * @param size Size of the data in bytes
+         * @return int SYSTEM_ERROR_NONE on success, or SYSTEM_ERROR_BAD_DATA if it's not valid
+         * 
+         * This clears the object first, so only the serving and neighbor cells are set. The status, contents, 
+         * and times are not encoded and stay cleared. If the data is not valid, the object is left cleared.
+         * Unknown integer keys are ignored so newer encoders can add fields. Neighbors are given the RAT of
+         * the serving cell.
+         * 
+         * This uses Device OS types. To decode on a host without Device OS, use QuectelTowerCbor::decode() in
+         * QuectelTowerCbor.h, which only uses the C++ standard library, or the tools/cbor2json example.
+         */
+        int fromCbor(const uint8_t *buf, size_t size);
+
+        /**
+         * @brief Returns true if the object appears to contain valid data.
+         * 
+         * @return true 
+         * @return false 
+         * 
+         * This just checks the serving cell RAT to make sure it's not NONE.
+         */
+        bool isValid() const;
+
+        /**
+         * @brief The serving cell. This member is public.
+         */
+        CellularServing serving;
+
+        /**
+         * @brief Neighbor cells. This member is public.
+         * 
+         * You can use vector-like members on this, like size(), at(), and iteration to work with the results.
+         * It holds at most MAX_NEIGHBORS entries; see addNeighbor() for the overflow policy.
+         */
+        InlineVector<CellularNeighbor, MAX_NEIGHBORS> neighbors;
+
+        /**
+         * @brief Number of neighbors discarded because the list was full in the last scan
+         */
+        uint16_t neighborsDiscarded {0};
+
+        /**
+         * @brief How the scan that produced this result finished
+         * 
+         * A scan that runs out of its time budget returns the data it has, so check this to tell
+         * a full result from a partial one.
+         */
+        ScanStatus status {ScanStatus::NONE};
+
+        /**
+         * @brief Which parts of the scan were received. This can be less than was requested if status is not COMPLETE.
+         */
+        ScanOptions contents {ScanOptions::NONE};
+
+        /**
+         * @brief System.millis() when the scan finished, or 0 if no scan has finished
+         */
+        uint64_t updatedMs {0};
+
+        /**
+         * @brief Returns the age of the scan in milliseconds. Only meaningful if updatedMs is not 0.
+         */
+        uint64_t getAgeMs() const { return System.millis() - updatedMs; }
+
+        /**
+         * @brief System.millis() when the neighbor cells were received from the modem, or 0 if they were not
+         * 
+         * This is earlier than updatedMs when the neighbors were reused from a previous scan (see withNeighborReuse()).
+         */
+        uint64_t neighborsUpdatedMs {0};
+
+        /**
+         * @brief true if the neighbor cells were copied from an earlier scan instead of queried
+         */
+        bool neighborsReused {false};
+
+        /**
+         * @brief Returns the age of the neighbor cells in milliseconds. Only meaningful if neighborsUpdatedMs is not 0.
+         */
+        uint64_t getNeighborsAgeMs() const { return System.millis() - neighborsUpdatedMs; }
+
+        /**
+         * @brief Returns true if this is the result of a complete scan no older than maxAgeMs
+         * 
+         * @param maxAgeMs Maximum age in milliseconds
+         * @param options The parts of the scan that must be present. Default is both serving and neighbor cells.
+         */
+        bool isFresh(uint64_t maxAgeMs, ScanOptions options = ScanOptions::ALL) const { 
+            return status == ScanStatus::COMPLETE && hasScanOption(contents, options) && updatedMs != 0 && getAgeMs() <= maxAgeMs; 
+        }
+
+    protected:
+        /**
+         * @brief Rebuild neighborTable from neighbors
+         */
+        void rebuildNeighborTable();
+
+        /**
+         * @brief Size of the open-addressed table used by addNeighbor() to find duplicates, a power of 2
+         */
+        static constexpr size_t NEIGHBOR_TABLE_SIZE = (MAX_NEIGHBORS <= 8) ? 16 : (MAX_NEIGHBORS <= 16) ? 32 : (MAX_NEIGHBORS <= 32) ? 64 : 
+            (MAX_NEIGHBORS <= 64) ? 128 : 256;
+        static_assert(MAX_NEIGHBORS <= 128, "QUECTELTOWERRK_MAX_NEIGHBORS must be 128 or less");
+
+        /**
+         * @brief Hash table of neighbor index + 1 (0 = empty) for addNeighbor(). Rebuilt if neighbors is changed directly.
+         */
+        uint8_t neighborTable[NEIGHBOR_TABLE_SIZE] {};
+
+        /**
+         * @brief Number of neighbors in neighborTable, used to detect when neighbors was changed directly
+         */
+        uint8_t neighborTableCount {0};
+    };
+
+    /**
+     * @brief Changes between two TowerInfo objects, for sending only what changed since the last publish
+     * 
+     * Neighbor cells are identified by channel (earfcn) and neighbor ID. This object is trivially copyable 
+     * and does not allocate memory.
+     */
+    class TowerDelta {
+    public:
+        /**
+         * @brief Default signal power change, in dB, before a tower is reported as changed
+         */
+        static constexpr int DEFAULT_SIGNAL_THRESHOLD {3};
+
+        /**
+         * @brief Identifies a neighbor cell that was removed
+         */
+        struct NeighborKey {
+            uint32_t earfcn; //!< Channel (EARFCN)
+            uint32_t neighborId; //!< Neighbor ID
+        };
+
+        /**
+         * @brief Clear the object so it contains no changes
+         */
+        void clear();
+
+        /**
+         * @brief Find the changes from previous to current
+         * 
+         * @param previous The last TowerInfo that was sent. Use an empty TowerInfo to send everything.
+         * @param current The new TowerInfo
+         * @param signalThreshold Only report a signal power change of at least this many dB (default: DEFAULT_SIGNAL_THRESHOLD)
+         * @return const TowerDelta& 
+         * 
+         * Signal changes smaller than signalThreshold are not reported, so the state rebuilt by apply() 
+         * can differ from current by up to that much. Keep sending deltas from the TowerInfo that the
+         * receiver has (the result of apply()), not the last scan, so small changes cannot add up.
+         */
+        const TowerDelta &compute(const TowerInfo &previous, const TowerInfo &current, int signalThreshold = DEFAULT_SIGNAL_THRESHOLD);
+
+        /**
+         * @brief Apply the changes to the previous TowerInfo to rebuild the current one
+         * 
+         * @param towerInfo The same TowerInfo passed as previous to compute(), modified in place
+         * @return int SYSTEM_ERROR_NONE on success, or SYSTEM_ERROR_NOT_FOUND if a changed or removed neighbor
+         * was not in towerInfo, which means it was not the same as previous. The other changes are still applied.
+         */
+        int apply(TowerInfo &towerInfo) const;
+
+        /**
+         * @brief Returns true if there are no changes
+         */
+        bool isEmpty() const;
+
+        /**
+         * @brief Write the changes to the writer as an object
+         * 
+         * @param writer 
+         * @return const TowerDelta& 
+         * 
+         * Keys are only included if there are changes of that type:
+         * 
+         * - "s": serving cell object, in the same format as TowerInfo::toJsonWriter(), if the serving cell changed. 
+         * An empty object if there is no longer a serving cell.
+         * - "ss": serving cell signal power, if only the signal changed
+         * - "a": array of added neighbors, each [nid, ch, str]
+         * - "c": array of neighbors whose signal changed, each [nid, ch, str]
+         * - "r": array of removed neighbors, each [nid, ch]
+         */
+        const TowerDelta &toJsonWriter(JSONWriter &writer) const;
+
+#ifdef SYSTEM_VERSION_v620
+        /**
+         * @brief Save the changes in a Variant object, in the same format as toJsonWriter(). Requires Device OS 6.2.0 or later.
+         * 
+         * @param obj Variant object to add to
+         * @return const TowerDelta& 
+         */
+        const TowerDelta &toVariant(Variant &obj) const;
+#endif // SYSTEM_VERSION_v620
+
+        bool servingChanged {false}; //!< The serving cell is a different cell (or no cell), see serving
+        bool servingSignalChanged {false}; //!< Only the serving cell signal power changed, see serving.signalPower
+        CellularServing serving; //!< The current serving cell if servingChanged or servingSignalChanged
+        InlineVector<CellularNeighbor, MAX_NEIGHBORS> added; //!< Neighbor cells in current but not previous
+        InlineVector<CellularNeighbor, MAX_NEIGHBORS> changed; //!< Neighbor cells in both whose signal power changed
+        InlineVector<NeighborKey, MAX_NEIGHBORS> removed; //!< Neighbor cells in previous but not current
+    };
+
+    /**
+     * @brief Reassembles +QENG response lines from Cellular.command callback data
+     * 
+     * The data passed to the Cellular.command callback may contain a partial line, more than
+     * one line, or unrelated URCs. This class buffers the data in a small fixed buffer and
+     * passes each complete +QENG line to TowerInfo::parseLine(). It does not allocate memory.
+     */
+    class QengLineAssembler {
+    public:
+        /**
+         * @brief Maximum length of a single line. Longer lines are discarded.
+         */
+        static constexpr size_t LINE_BUF_SIZE {160};
+
+        /**
+         * @brief Discard any partial line. Call before issuing a new command.
+         */
+        void reset();
+
+        /**
+         * @brief Set the parser used for complete lines. The default is the parser from getDetectedQengParser().
+         * 
+         * @param parser Parser for the modem family, from getQengParser()
+         */
+        void setParser(const QengParser &parser) { this->parser = &parser; }
+
+        /**
+         * @brief Add data received from the modem
+         * 
+         * @param buf Data from the Cellular.command callback, does not need to be null terminated
+         * @param len Length of the data in bytes
+         * @param towerInfo Object to parse complete lines into
+         */
+        void feed(const char *buf, size_t len, TowerInfo &towerInfo);
+
+        /**
+         * @brief Process a partial line at the end of a response, if there is one
+         * 
+         * @param towerInfo Object to parse the line into
+         */
+        void flush(TowerInfo &towerInfo);
+
+    protected:
+        /**
+         * @brief Parser state
+         */
+        enum class State {
+            LineStart,          //!< Skipping line terminators before the start of a line
+            InLine,             //!< Adding characters to lineBuf
+            Discard,            //!< Line was too long, skipping until end of line
+        };
+
+        /**
+         * @brief Parse the line in lineBuf, which can contain more than one +QENG response
+         */
+        void processLine(TowerInfo &towerInfo);
+
+        const QengParser *parser {nullptr}; //!< Parser to use, or nullptr for the default
+        State state {State::LineStart}; //!< Current parser state
+        size_t lineLen {0}; //!< Number of bytes in lineBuf
+        char lineBuf[LINE_BUF_SIZE]; //!< Buffer for the line being assembled
+    };
+
+    /**
+     * @brief Stack size of the worker thread (bytes)
+     * 
+     * Callbacks run on the worker thread, and scanWithCallback() copies a TowerInfo onto its stack for the
+     * by-value callback. Since a TowerInfo holds its neighbors inline, the stack is the Device OS default
+     * plus one TowerInfo, and grows with QUECTELTOWERRK_MAX_NEIGHBORS.
+     */
+    static constexpr size_t THREAD_STACK_SIZE {OS_THREAD_STACK_SIZE_DEFAULT + sizeof(TowerInfo)};
+
+    /**
+     * @brief Identifies a scan request so it can be cancelled. 0 is never a valid scan ID.
+     */
+    typedef uint32_t ScanId;
+
+    /**
+     * @brief Callback function type for scanWithCallbackRef()
+     * 
+     * The TowerInfo reference is only valid during the callback. Copy it if you need it later.
+     */
+    typedef std::function<void(const TowerInfo &towerInfo)> ScanCallbackRef;
+
+    /**
+     * @brief Only update the signal strength when it's requested, instead of every second
+     * 
+     * @param enable true to enable on-demand mode, false for periodic mode (the default)
+     * @return QuectelTowerRK& 
+     * 
+     * In periodic mode, the worker thread calls Cellular.RSSI() every PERIOD_SUCCESS_MS, or at the
+     * retry period after a failure. In on-demand mode, the worker thread sleeps until there is a request.
+     * When getSignal() finds the saved value is older than its max_age, it returns -ENODATA and asks
+     * the worker thread to refresh it in the background, so a later call will succeed. This saves power
+     * on devices that rarely check the signal strength. After a failure, refresh requests are ignored
+     * until the retry period ends. It starts at PERIOD_ERROR_MS and doubles after each consecutive
+     * failure, up to BACKOFF_MAX_MS.
+     */
+    QuectelTowerRK &withSignalOnDemand(bool enable = true);
+
+    /**
+     * @brief Select where the signal strength comes from
+     * 
+     * @param source SignalSource::RSSI (default) or SignalSource::SERVING_CELL
+     * @return QuectelTowerRK& 
+     * 
+     * @param pollPeriodMs With SignalSource::SERVING_CELL in periodic mode, how often to send 
+     * AT+QENG="servingcell" when no scan has updated the signal (milliseconds), or 0 (the default) to never poll
+     * 
+     * With SignalSource::SERVING_CELL, Cellular.RSSI() is not used. Every scan that includes the serving 
+     * cell updates the signal. In periodic mode, that is the only source unless pollPeriodMs is set, 
+     * so getSignal() returns -ENODATA if there has not been a scan within its max_age. In on-demand 
+     * mode (withSignalOnDemand()), a refresh request sends a single AT+QENG="servingcell" command. Each
+     * scan postpones the next poll. This avoids the extra AT commands from Cellular.RSSI() competing
+     * with Device OS for the modem.
+     * 
+     * Changing the source also refreshes the signal once. Call this from setup().
+     */
+    QuectelTowerRK &withSignalSource(SignalSource source, unsigned long pollPeriodMs = 0);
+
+    /**
+     * @brief Convert the RSRP and RSRQ from a serving cell to a CellularSignal
+     * 
+     * @param serving The serving cell from a scan
+     * @param[out] signal Filled in with the signal strength and quality
+     * @return true if the serving cell had a valid RAT and RSRP, false if signal was not changed
+     * 
+     * Strength is scaled from RSRP -140 to -44 dBm and quality from RSRQ -19.5 to -3 dB, like Device OS does
+     * for LTE. If the RSRQ is not available, the quality is 0.
+     */
+    static bool signalFromServing(const CellularServing &serving, CellularSignal &signal);
+
+    /**
+     * @brief Ask the worker thread to update the signal strength. Does not block.
+     * 
+     * This is used internally by getSignal() in on-demand mode, but you can also call it to
+     * refresh the value in advance.
+     */
+    void requestSignalRefresh();
+
+    /**
+     * @brief Scan for towers, blocking.
+     * 
+     * @param towerInfo Filled in with serving tower and neighboring tower information.
+     * @param timeoutMs How long to wait in milliseconds for a response (0 = wait forever). Default is 10 seconds.
+     * @param options What to request: ScanOptions::SERVING, ScanOptions::NEIGHBORS, or ScanOptions::ALL (default)
+     * @retval SYSTEM_ERROR_NONE The scan ran. If no data was received, towerInfo.status is ScanStatus::FAILED or TIMEOUT.
+     * @retval SYSTEM_ERROR_BUSY Recent scans failed, so the modem was not queried (ScanStatus::BACKOFF). See getModemHealth().
+     * @retval SYSTEM_ERROR_TIMEOUT No result within timeoutMs
+     * @retval SYSTEM_ERROR_INVALID_ARGUMENT options is ScanOptions::NONE
+     * 
+     * This call can take as little as 20 milliseconds, but may take up to a few seconds if connected to cellular.
+     * It can block for longer if not connected to cellular as it will wait until connected.
+     * 
+     * timeoutMs is also the time budget for the scan. The AT commands are shortened to fit in it, and if 
+     * they run out of time, towerInfo contains what was received and towerInfo.status is 
+     * ScanStatus::PARTIAL or ScanStatus::TIMEOUT.
+     * 
+     * The calling thread sleeps on a semaphore until the result arrives or the timeout expires, so it
+     * does not use CPU time while waiting.
+     * 
+     * ScanOptions::SERVING only needs one AT command, so it's the fastest choice when you don't need the
+     * neighbor cells. If another caller's scan is pending, the requests are merged, so the result may 
+     * contain more than you asked for. Check towerInfo.contents to see what it contains. towerInfo.status
+     * is ScanStatus::COMPLETE if it contains everything in options, even if another caller's part failed.
+     */
+    int scanBlocking(TowerInfo &towerInfo, unsigned long timeoutMs = 10000, ScanOptions options = ScanOptions::ALL);
+
+    /**
+     * @brief Get the saved tower information if it's fresh enough, otherwise scan, blocking.
+     * 
+     * @param towerInfo Filled in with serving tower and neighboring tower information.
+     * @param maxAgeMs Use the saved scan if it completed successfully no more than this many milliseconds ago, or 0 to always scan
+     * @param timeoutMs How long to wait in milliseconds for a new scan (0 = wait forever). Default is 10 seconds.
+     * @return int SYSTEM_ERROR_NONE on success, or an error from scanBlocking()
+     * 
+     * When the saved scan is fresh, this returns immediately without using the modem.
+     */
+    int scanIfOlderThan(TowerInfo &towerInfo, unsigned long maxAgeMs, unsigned long timeoutMs = 10000);
+
+    /**
+     * @brief Asynchronous scan for cellular towers with callback function
+     * 
+     * @param scanCallback Callback function to call when complete
+     * @param scanId If not null, filled in with the ID of this request, which can be passed to cancelScan()
+     * @param timeoutMs Time budget for the scan in milliseconds (0 = no limit)
+     * @param options What to request: ScanOptions::SERVING, ScanOptions::NEIGHBORS, or ScanOptions::ALL (default)
+     * @retval SYSTEM_ERROR_NONE Success
+     * @retval SYSTEM_ERROR_BUSY Cannot start a new scan
+     * @retval SYSTEM_ERROR_INVALID_ARGUMENT options is ScanOptions::NONE
+     * 
+     * The callback function is only called if the return value is SYSTEM_ERROR_NONE. It is called from
+     * a separate worker thread.
+     * 
+     * If a scan has already been requested but has not completed, this call joins that scan instead
+     * of starting another one, and all callbacks receive the same result. Up to MAX_SCAN_SUBSCRIBERS
+     * callbacks can wait for the same scan.
+     * 
+     * Callback function prototype for a C++ function or lambda:
+     * 
+     * void callback(TowerInfo towerInfo)
+     * 
+     * This call can take as little as 20 milliseconds, but may take up to a few seconds if connected to cellular.
+     * It can take for longer if not connected to cellular as it will wait until connected.
+     */
+    int scanWithCallback(std::function<void(TowerInfo towerInfo)> scanCallback, ScanId *scanId = nullptr, unsigned long timeoutMs = SCAN_TIMEOUT_DEFAULT_MS, ScanOptions options = ScanOptions::ALL);
+
+    /**
+     * @brief Asynchronous scan for cellular towers with a callback that receives a const reference
+     * 
+     * @param scanCallback Callback function to call when complete
+     * @param scanId If not null, filled in with the ID of this request, which can be passed to cancelScan()
+     * @param timeoutMs Time budget for the scan in milliseconds (0 = no limit)
+     * @param options What to request: ScanOptions::SERVING, ScanOptions::NEIGHBORS, or ScanOptions::ALL (default)
+     * @retval SYSTEM_ERROR_NONE Success
+     * @retval SYSTEM_ERROR_BUSY Cannot start a new scan
+     * @retval SYSTEM_ERROR_INVALID_ARGUMENT options is ScanOptions::NONE
+     * 
+     * This is the same as scanWithCallback() except the result is not copied for the callback.
+     * The reference is only valid until the callback returns.
+     * 
+     * Callback function prototype for a C++ function or lambda:
+     * 
+     * void callback(const TowerInfo &towerInfo)
+     */
+    int scanWithCallbackRef(ScanCallbackRef scanCallback, ScanId *scanId = nullptr, unsigned long timeoutMs = SCAN_TIMEOUT_DEFAULT_MS, ScanOptions options = ScanOptions::ALL);
+
+    /**
+     * @brief Start scan for cellular towers
+     *
+     * @param options What to request: ScanOptions::SERVING, ScanOptions::NEIGHBORS, or ScanOptions::ALL (default)
+     * @retval SYSTEM_ERROR_NONE Success
+     * @retval SYSTEM_ERROR_BUSY Cannot start a new scan
+     * @retval SYSTEM_ERROR_INVALID_ARGUMENT options is ScanOptions::NONE
+     * 
+     * This is a low-level function; you'd typically use scanBlocking() or scanWithCallback().
+     * If a scan is already pending this does nothing and returns SYSTEM_ERROR_NONE, as the pending
+     * scan will save new tower information.
+     */
+    int startScan(ScanOptions options = ScanOptions::ALL);
+
+    /**
+     * @brief Start scan for cellular towers, returning an ID that can be used to cancel it
+     *
+     * @param scanId Filled in with the ID of this request
+     * @param timeoutMs Time budget for the scan in milliseconds (0 = no limit)
+     * @param options What to request: ScanOptions::SERVING, ScanOptions::NEIGHBORS, or ScanOptions::ALL (default)
+     * @retval SYSTEM_ERROR_NONE Success
+     * @retval SYSTEM_ERROR_BUSY Cannot start a new scan
+     * @retval SYSTEM_ERROR_INVALID_ARGUMENT options is ScanOptions::NONE
+     * 
+     * Use getTowerInfo() to get the result after the scan completes.
+     */
+    int startScan(ScanId &scanId, unsigned long timeoutMs = SCAN_TIMEOUT_DEFAULT_MS, ScanOptions options = ScanOptions::ALL);
+
+    /**
+     * @brief This method makes sure the callback is not called 
+     * 
+     * It's used internally by scanBlocking but if you are using scanWithCallback you can also
+     * use this to cancel the pending callback. 
+     * 
+     * This removes all callbacks waiting for the pending scan, including ones started by other code.
+     * Once this returns, none of them will be called, even if the scan completes at the same time.
+     * Prefer cancelScan(ScanId) to only cancel your own request.
+     */
+    void cancelScan();
+
+    /**
+     * @brief Cancel a single scan request
+     * 
+     * @param scanId The ID from startScan(), scanWithCallback(), or scanWithCallbackRef()
+     * @retval SYSTEM_ERROR_NONE The request was cancelled and its callback will not be called
+     * @retval SYSTEM_ERROR_NOT_FOUND The request already completed (its callback was called) or was already cancelled
+     * 
+     * This is safe to call while the scan is completing on the worker thread: if the callback is running, 
+     * this waits for it to return. Once this returns, the callback is not running and will not be called.
+     * 
+     * If all requests for a scan are cancelled before the scan starts, the modem is not used. If they
+     * are cancelled after the serving cell request, the neighbor cell request is skipped.
+     */
+    int cancelScan(ScanId scanId);
+
+    /**
+     * @brief Get the cellular signal strength
+     *
+     * @param[out] signal Object with signal strength values
+     * @param[in] max_age How old a measurement can be to be valid, in seconds
+     * @retval 0 Success
+     * @retval -ENODATA Measurement is old
+     * 
+     * This does not lock the mutex and can be called from any thread at any rate. In on-demand mode
+     * (withSignalOnDemand()), an old measurement also requests a refresh.
+     */
+    int getSignal(CellularSignal &signal, unsigned int max_age=DEFAULT_MAX_AGE_SEC);
+
+    /**
+     * @brief Get the signal strength and the time it was measured
+     * 
+     * @param[out] snapshot Filled in with the signal and System.millis() at the time of measurement
+     * 
+     * This does not lock the mutex and can be called from any thread at any rate. The signal and
+     * timestamp are always consistent with each other.
+     */
+    void getSignalSnapshot(SignalSnapshot &snapshot) const { signalSnapshot.read(snapshot); }
+
+    /**
+     * @brief Get the failure counters and last results of the signal poll and scans
+     * 
+     * @param[out] health Filled in with the current state
+     * 
+     * This does not lock the mutex and can be called from any thread.
+     */
+    void getModemHealth(ModemHealth &health) const { modemHealth.read(health); }
+
+    /**
+     * @brief Get the time of the last signal strength update
+     *
+     * @return unsigned int Value of System.uptime() in seconds at the last update, or 0 if not valid
+     */
+    unsigned int getSignalUpdate();
+
+    /**
+     * @brief Get the time of the last signal strength update in milliseconds
+     *
+     * @return uint64_t Value of System.millis() at the last update, or 0 if not valid
+     */
+    uint64_t getSignalUpdateMs();
+
+    /**
+     * @brief Get the most recently retrieved tower information
+     * 
+     * @param towerInfo 
+     * 
+     * This returns the last saved value and does not scan again. See scanBlocking and scanWithCallback.
+     * Scans that receive no data (ScanStatus::TIMEOUT, FAILED, or BACKOFF) are not saved, and neither are 
+     * scans requested while cellular is not ready, so this keeps returning the last scan that received data.
+     * 
+     * This does not lock the mutex and does not block if a scan is in progress. It can safely be called
+     * from any thread.
+     */
+    void getTowerInfo(TowerInfo &towerInfo) const;
+
+    /**
+     * @brief Get the most recently retrieved tower information if it's fresh enough
+     * 
+     * @param[out] towerInfo Filled in with the last saved value, even if it's old
+     * @param[in] maxAgeMs How old the scan can be to be valid, in milliseconds
+     * @retval 0 Success
+     * @retval -ENODATA The saved scan is old, incomplete, or there is no scan yet
+     * 
+     * This does not scan or block. Use towerInfo.getAgeMs() to find the age of the saved scan.
+     */
+    int getTowerInfo(TowerInfo &towerInfo, unsigned long maxAgeMs) const;
+
+    /**
+     * @brief Set how old a saved scan can be for addToEventHandler to use it instead of scanning
+     * 
+     * @param maxAgeMs Maximum age in milliseconds, or 0 to always scan. Default is DEFAULT_TOWER_INFO_MAX_AGE_MS.
+     * @return QuectelTowerRK& 
+     * 
+     * Call this from setup() before events are published.
+     */
+    QuectelTowerRK &withTowerInfoMaxAge(unsigned long maxAgeMs) { towerInfoMaxAgeMs = maxAgeMs; return *this; }
+
+    /**
+     * @brief Get the maximum age of a saved scan for addToEventHandler in milliseconds
+     */
+    unsigned long getTowerInfoMaxAge() const { return towerInfoMaxAgeMs; }
+
+    /**
+     * @brief Reuse the neighbor cells from the previous scan when the serving cell has not changed
+     * 
+     * @param maxAgeMs How old the reused neighbor cells can be in milliseconds, or 0 to always query them (default)
+     * @return QuectelTowerRK& 
+     * 
+     * For devices that don't move, the neighbor cells rarely change while the serving cell stays the same.
+     * When enabled, a scan that requests the neighbor cells first checks the serving cell. If it's the
+     * same cell as the last saved scan and that scan's neighbor cells were queried no more than maxAgeMs ago,
+     * they are copied instead of sending AT+QENG="neighbourcell". TowerInfo::neighborsReused and 
+     * TowerInfo::getNeighborsAgeMs() tell you when this happened.
+     * 
+     * Call this from setup().
+     */
+    QuectelTowerRK &withNeighborReuse(unsigned long maxAgeMs) { neighborReuseMaxAgeMs = maxAgeMs; return *this; }
+
+    /**
+     * @brief Make addToEventHandler return immediately instead of waiting for a scan
+     * 
+     * @param nonBlocking true to enable non-blocking mode, false for the default blocking mode
+     * @param maxStalenessMs The oldest saved scan to attach to the event, in milliseconds
+     * @return QuectelTowerRK& 
+     * 
+     * In non-blocking mode, addToEventHandler attaches the saved scan if it's no older than maxStalenessMs,
+     * along with its age in seconds in the towersAge field. If the saved scan is older than 
+     * withTowerInfoMaxAge(), it also starts a scan in the background so the next event has newer data.
+     * The modem is never waited on, so the event is not delayed, but the first event after startup
+     * may not have any towers.
+     * 
+     * Call this from setup() before events are published.
+     */
+    QuectelTowerRK &withEventHandlerNonBlocking(bool nonBlocking = true, unsigned long maxStalenessMs = DEFAULT_EVENT_HANDLER_MAX_STALENESS_MS) {
+        eventHandlerNonBlocking = nonBlocking;
+        eventHandlerMaxStalenessMs = maxStalenessMs;
+        return *this;
+    }
+
+    /**
+     * @brief Get the number of times tower information has been saved
+     * 
+     * @return uint32_t Generation counter, incremented after every scan that is saved
+     * 
+     * You can compare this to a previous value to determine if getTowerInfo() will return new data.
+     */
+    uint32_t getTowerInfoGeneration() const { return towerInfoGeneration.load(std::memory_order_acquire); }
+
+    /**
+     * @brief Lock object
+     *
+     */
+    inline void lock() {mutex.lock();}
+
+    /**
+     * @brief Unlock object
+     *
+     */
+    inline void unlock() {mutex.unlock();}
+
+#ifdef SYSTEM_VERSION_v620
+    /**
+     * @brief Handler function used with the LocationFusionRK library
+     * 
+     * @param eventData 
+     * @param locVariant 
+     */
+    static void addToEventHandler(Variant &eventData, Variant &locVariant);
+#endif // SYSTEM_VERSION_v620
+
+
+    /**
+     * @brief Parse a AT+QENG RAT string to convert it to a RadioAccessTechnology value (an int).
+     * 
+     * @param str 
+     * @return RadioAccessTechnology 
+     */
+    static RadioAccessTechnology parseRadioAccessTechnology(const char *str);
+
+    /**
+     * @brief Parse the qualifier after "neighbourcell " in an AT+QENG response
+     * 
+     * @param str Qualifier string, such as "intra" or "inter". Does not need to be null terminated.
+     * @param len Length of the qualifier in bytes
+     * @return NeighborType NeighborType::UNKNOWN if not a known qualifier
+     */
+    static NeighborType parseNeighborType(const char *str, size_t len);
+
+    /**
+     * @brief Parse the AT+CGMM model string to determine the modem family
+     * 
+     * @param model Model string, such as "BG96" or "EG91-NAX". Does not need to be null terminated.
+     * @param len Length of the model string in bytes
+     * @return ModemFamily ModemFamily::UNKNOWN if not a known model
+     */
+    static ModemFamily parseModemFamily(const char *model, size_t len);
+
+    /**
+     * @brief Get the AT+QENG parser for a modem family
+     * 
+     * @param family The modem family
+     * @return const QengParser& The parser, which has static storage duration
+     */
+    static const QengParser &getQengParser(ModemFamily family);
+
+    /**
+     * @brief Get the AT+QENG parser for the modem family detected at startup
+     * 
+     * @return const QengParser& The parser for getModemFamily(), which is the BG95/BG96 parser until the
+     * modem family has been detected
+     * 
+     * This is used by the parse functions that do not take a QengParser, and can be called from any thread.
+     */
+    static const QengParser &getDetectedQengParser() { return getQengParser(detectedModemFamily); }
+
+    /**
+     * @brief Get the modem family detected at startup
+     * 
+     * @return ModemFamily ModemFamily::UNKNOWN if cellular has not been ready yet
+     * 
+     * This can be called from any thread.
+     */
+    ModemFamily getModemFamily() const { return detectedModemFamily; }
+
+    /**
+     * @brief Singleton class instance access for QuectelTowerRK
+     *
+     * @return QuectelTowerRK&
+     */
+    static QuectelTowerRK &instance()
+    {
+        if(!_instance)
+        {
+            _instance = new QuectelTowerRK();
+        }
+        return *_instance;
+    }
+
+private:
+    /**
+     * @brief The constructor is private because the class is a singleton
+     * 
+     * Use QuectelTowerRK::instance() to instantiate the singleton.
+     */
+    QuectelTowerRK();
+
+    /**
+     * @brief The destructor is private because the class is a singleton and cannot be deleted
+     */
+    virtual ~QuectelTowerRK();
+
+    /**
+     * This class is a singleton and cannot be copied
      */
     QuectelTowerRK(const QuectelTowerRK&) = delete;
 
@@ -445,22 +1584,78 @@ private:
      */
     QuectelTowerRK& operator=(const QuectelTowerRK&) = delete;
 
-    CellularSignal cellularSignal; //!< Last result from Cellular.RSSI()
-    unsigned int cellularSignalLastUpdate; //!< Value of System.uptime() at last RSSI update (in seconds)
+    SeqLocked<SignalSnapshot> signalSnapshot; //!< Last result from Cellular.RSSI(), written only by the worker thread
 
-    TowerInfo receivedTowerInfo; //!< Value currently being received by the worker thread
-    TowerInfo savedTowerInfo; //!< Copy of complete data, to reduce the amount of time the mutex is locked
+    SeqLocked<TowerInfo> towerInfoSlots[2]; //!< Saved tower information, the published slot is towerInfoGeneration % 2
+    std::atomic<uint32_t> towerInfoGeneration {0}; //!< Incremented each time a slot is published
+    unsigned long towerInfoMaxAgeMs {DEFAULT_TOWER_INFO_MAX_AGE_MS}; //!< Set by withTowerInfoMaxAge()
+    bool eventHandlerNonBlocking {false}; //!< Set by withEventHandlerNonBlocking()
+    unsigned long neighborReuseMaxAgeMs {0}; //!< Set by withNeighborReuse(), 0 = disabled
+    bool reuseNeighbors(TowerInfo &towerInfo); //!< Copy neighbors from the last saved scan if allowed, from the worker thread
+    unsigned long eventHandlerMaxStalenessMs {DEFAULT_EVENT_HANDLER_MAX_STALENESS_MS}; //!< Set by withEventHandlerNonBlocking()
+    TowerInfo *receivedTowerInfo; //!< Value currently being received by the worker thread, in the unpublished slot
+    QengLineAssembler lineAssembler; //!< Reassembles response lines for receivedTowerInfo
+    std::atomic<bool> modemFamilyDetected {false}; //!< true after AT+CGMM has been successfully queried
 
     RecursiveMutex mutex; //!< Mutex to prevent accessing certain data from multiple threads at the same time
     os_queue_t commandQueue; //!< Command requests to be processed by the worker thread
     Thread * thread; //!< The worker thread
 
-    static int serving_cb(int type, const char* buf, int len, QuectelTowerRK* context); //!< Callback for Cellular.command for serving cell request
-    static int neighbor_cb(int type, const char* buf, int len, QuectelTowerRK* context); //!< Callback for Cellular.command for neighbor cell request
+    static int qeng_cb(int type, const char* buf, int len, QuectelTowerRK* context); //!< Callback for Cellular.command for serving and neighbor cell requests
+    std::atomic<bool> signalOnDemand {false}; //!< true if the signal is only updated when requested
+    std::atomic<bool> signalRefreshPending {false}; //!< true if a RefreshSignal command is in the queue
+    system_tick_t nextSignalCheckMs {0}; //!< millis() value before which the signal is not checked again
+    std::atomic<SignalSource> signalSource {SignalSource::RSSI}; //!< Set by withSignalSource()
+    std::atomic<unsigned long> servingPollPeriodMs {0}; //!< Set by withSignalSource(), 0 = serving cell is only polled on request
+    bool isSignalPeriodic() const; //!< true if the worker thread checks the signal without a request
+    system_tick_t getSignalPeriodMs() const; //!< Time from a successful signal update to the next periodic check
+    void updateSignal(); //!< Call Cellular.RSSI() or poll the serving cell and save the result, from the worker thread
+    bool updateSignalFromServing(const CellularServing &serving); //!< Save the signal from a serving cell, from the worker thread
+    SeqLocked<ModemHealth> modemHealth; //!< Written only by the worker thread, read by getModemHealth()
+    void recordSignalResult(int result); //!< Update modemHealth and schedule the next signal poll, from the worker thread
+    void recordScanResult(int result); //!< Update modemHealth and the scan backoff, from the worker thread
+    static system_tick_t getBackoffMs(uint16_t failures); //!< Retry period after the given number of consecutive failures
+    static int cgmm_cb(int type, const char* buf, int len, ModemFamily* family); //!< Callback for Cellular.command for model request
+    void detectModemFamily(); //!< Query the modem model and select the AT+QENG parser
     CommandCode waitOnEvent(system_tick_t timeout); //!< Wait for a command to be added to the queue
     void threadFunction(); //!< Worker thread function
+    TowerInfo &beginTowerInfoUpdate(); //!< Start writing to the unpublished slot, from the worker thread
+    const TowerInfo &publishTowerInfo(); //!< Publish the slot from beginTowerInfoUpdate(), from the worker thread
+    void abandonTowerInfoUpdate(); //!< Finish the slot from beginTowerInfoUpdate() without publishing, from the worker thread
 
-    std::function<void(TowerInfo towerInfo)> scanCallback = nullptr; //!< Callback when scan is complete
+    /**
+     * @brief A request waiting for the pending scan to complete
+     */
+    struct ScanSubscriber {
+        ScanId scanId; //!< ID returned to the caller
+        uint64_t deadlineMs; //!< System.millis() value when the result is no longer useful to the caller
+        ScanOptions options; //!< What the caller asked for
+        ScanCallbackRef callback; //!< Callback when scan is complete, may be empty
+    };
+
+    /**
+     * @brief Convert a timeout in milliseconds (0 = no limit) to a System.millis() deadline
+     */
+    static uint64_t timeoutToDeadline(unsigned long timeoutMs);
+
+    ScanSubscriber scanSubscribers[MAX_SCAN_SUBSCRIBERS]; //!< Requests waiting for the scan, protected by mutex
+    size_t numScanSubscribers {0}; //!< Number of entries in scanSubscribers in use, protected by mutex
+    bool scanPending {false}; //!< A Measure command is queued or in progress, protected by mutex
+    bool scanRequestedWithoutId {false}; //!< startScan() was called with no ID, protected by mutex
+    uint64_t scanWithoutIdDeadlineMs {0}; //!< Deadline for startScan() with no ID, protected by mutex
+    ScanOptions scanWithoutIdOptions {ScanOptions::NONE}; //!< Options for startScan() with no ID, protected by mutex
+    ScanId lastScanId {0}; //!< Last scan ID assigned, protected by mutex
+    ScanId dispatchScanIds[MAX_SCAN_SUBSCRIBERS]; //!< IDs whose callbacks dispatchScanResult() has not called yet, 0 if cancelled, protected by mutex
+    size_t numDispatchScanIds {0}; //!< Number of entries in dispatchScanIds in use, protected by mutex
+    ScanId runningScanId {0}; //!< ID whose callback is running on the worker thread, or 0, protected by mutex
+    RecursiveMutex callbackMutex; //!< Held by the worker thread while a scan callback is running
+    void waitForScanCallback(); //!< Wait for the running scan callback to return, unless called from it
+    int queueScan(); //!< Queue a Measure command if one is not pending
+    uint64_t getScanDeadlineMs(ScanOptions &options); //!< Latest deadline and combined options of the requests for the pending scan, or 0 if all were cancelled, from the worker thread
+    int qengCommand(const char *type, uint64_t deadlineMs, int *sentResult = nullptr, system_tick_t *sentTimeoutMs = nullptr); //!< Send AT+QENG within the deadline, from the worker thread. sentTimeoutMs is 0 if it was not sent.
+    void dispatchScanResult(const TowerInfo &towerInfo); //!< Call the subscribed callbacks, from the worker thread
 
     static QuectelTowerRK *_instance; //!< Singleton instance
+
+    static std::atomic<ModemFamily> detectedModemFamily; //!< Modem family, set once by detectModemFamily() from the worker thread
 };
@@ -0,0 +1,121 @@
+// Benchmark of the AT+QENG response parsers: the schema tokenizer against the sscanf parser it replaced
+
+#include "Particle.h"
+#include "QuectelTowerRK.h"
+
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#endif
+
+static const char servingLine[] = "+QENG: \"servingcell\",\"NOCONN\",\"CAT-M\",\"FDD\",310,410,A1B2C3D,123,5110,12,3,3,1A2B,-95,-10,-65,15,28";
+static const char neighborLine[] = "+QENG: \"neighbourcell intra\",\"CAT-M\",5110,200,-12,-101,-70,10,20";
+
+static const int ITERATIONS = 200000;
+
+// The sscanf parsers from version 0.0.2, with the same result fields
+static int sscanfParseServing(QuectelTowerRK::CellularServing &serving, const char *in) {
+    char stateStr[16] = {};
+    char ratStr[16] = {};
+    unsigned long cellId = 0;
+
+    serving.clear();
+
+    auto nitems = sscanf(in, " +QENG: \"servingcell\",\"%15[^\"]\",\"%15[^\"]\",\"%*15[^\"]\","
+            "%u,%u,%lX,"
+            "%*15[^,],%*15[^,],%*15[^,],%*15[^,],%*15[^,],%X,%d",
+            stateStr, ratStr,
+            &serving.mcc, &serving.mnc, &cellId, &serving.lac, &serving.signalPower);
+    if (nitems < 7) {
+        return SYSTEM_ERROR_NOT_ENOUGH_DATA;
+    }
+    serving.cellId = (uint32_t)cellId;
+
+    serving.rat = QuectelTowerRK::parseRadioAccessTechnology(ratStr);
+    if (serving.rat == QuectelTowerRK::RadioAccessTechnology::NONE) {
+        return SYSTEM_ERROR_NOT_SUPPORTED;
+    }
+    return SYSTEM_ERROR_NONE;
+}
+
+static int sscanfParseNeighbor(QuectelTowerRK::CellularNeighbor &neighbor, const char *in) {
+    char ratStr[16] = {0};
+    unsigned long earfcn = 0, neighborId = 0;
+
+    neighbor.clear();
+
+    auto nitems = sscanf(in, " +QENG: \"neighbourcell %*15[^\"]\",\"%15[^\"]\",%lu,%lu,%d,%d,%d",
+            ratStr,
+            &earfcn, &neighborId, &neighbor.signalQuality, &neighbor.signalPower, &neighbor.signalStrength);
+    if (nitems < 6) {
+        return SYSTEM_ERROR_NOT_ENOUGH_DATA;
+    }
+    neighbor.earfcn = (uint32_t)earfcn;
+    neighbor.neighborId = (uint32_t)neighborId;
+
+    neighbor.rat = QuectelTowerRK::parseRadioAccessTechnology(ratStr);
+    if (neighbor.rat == QuectelTowerRK::RadioAccessTechnology::NONE) {
+        return SYSTEM_ERROR_NOT_SUPPORTED;
+    }
+    return SYSTEM_ERROR_NONE;
+}
+
+/**
+ * @brief Run fn ITERATIONS times and print the time and cycles per call
+ */
+template<typename Fn>
+static void run(const char *name, Fn fn) {
+    // Warm up caches and the branch predictor
+    for(int ii = 0; ii < ITERATIONS / 10; ii++) {
+        fn();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+#ifdef HAVE_RDTSC
+    uint64_t startCycles = __rdtsc();
+#endif
+    for(int ii = 0; ii < ITERATIONS; ii++) {
+        fn();
+    }
+#ifdef HAVE_RDTSC
+    double cycles = (double)(__rdtsc() - startCycles) / ITERATIONS;
+#endif
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / ITERATIONS;
+
+#ifdef HAVE_RDTSC
+    printf("%-24s %8.1f ns/line %8.0f cycles/line\n", name, ns, cycles);
+#else
+    printf("%-24s %8.1f ns/line\n", name, ns);
+#endif
+}
+
+int main() {
+    QuectelTowerRK::CellularServing serving, sscanfServing;
+    QuectelTowerRK::CellularNeighbor neighbor, sscanfNeighbor;
+    const QuectelTowerRK::QengParser &parser = QuectelTowerRK::getQengParser(QuectelTowerRK::ModemFamily::BG96);
+
+    // Both parsers must agree on the fields the sscanf version extracted
+    if (parser.parseServing(serving, servingLine, strlen(servingLine)) != 0 || sscanfParseServing(sscanfServing, servingLine) != 0 ||
+        serving.rat != sscanfServing.rat || serving.mcc != sscanfServing.mcc || serving.mnc != sscanfServing.mnc ||
+        serving.cellId != sscanfServing.cellId || serving.lac != sscanfServing.lac || serving.signalPower != sscanfServing.signalPower) {
+        printf("servingcell results differ\n");
+        return 1;
+    }
+    if (parser.parseNeighbor(neighbor, neighborLine, strlen(neighborLine)) != 0 || sscanfParseNeighbor(sscanfNeighbor, neighborLine) != 0 ||
+        neighbor.rat != sscanfNeighbor.rat || neighbor.earfcn != sscanfNeighbor.earfcn || neighbor.neighborId != sscanfNeighbor.neighborId ||
+        neighbor.signalPower != sscanfNeighbor.signalPower || neighbor.signalQuality != sscanfNeighbor.signalQuality) {
+        printf("neighbourcell results differ\n");
+        return 1;
+    }
+
+    // The volatile result keeps the compiler from removing the calls
+    volatile int result = 0;
+    run("servingcell tokenizer", [&]() { result = result + parser.parseServing(serving, servingLine, sizeof(servingLine) - 1); });
+    run("servingcell sscanf", [&]() { result = result + sscanfParseServing(sscanfServing, servingLine); });
+    run("neighbourcell tokenizer", [&]() { result = result + parser.parseNeighbor(neighbor, neighborLine, sizeof(neighborLine) - 1); });
+    run("neighbourcell sscanf", [&]() { result = result + sscanfParseNeighbor(sscanfNeighbor, neighborLine); });
+
+    return 0;
+}
@@ -0,0 +1,94 @@
+// Benchmark of the CPU time the calling thread uses while scanBlocking() waits for the modem,
+// against the delay(1) polling loop it replaced
+
+#include "Particle.h"
+#include "QuectelTowerRK.h"
+
+#include <sys/resource.h>
+#include <time.h>
+
+static const int NUM_SCANS = 20;
+static const unsigned long SERVING_LATENCY_MS = 20;
+static const unsigned long NEIGHBOR_LATENCY_MS = 80;
+
+/**
+ * @brief The scanBlocking() from version 0.0.2, which polls a flag every millisecond
+ */
+static int pollingScanBlocking(QuectelTowerRK::TowerInfo &towerInfo, unsigned long timeoutMs) {
+    // The original used a plain bool; it's atomic here so the benchmark itself is well defined
+    std::atomic<bool> done {false};
+
+    unsigned long startMs = millis();
+
+    int ret = QuectelTowerRK::instance().scanWithCallback([&done, &towerInfo](QuectelTowerRK::TowerInfo tempTowerInfo) {
+        towerInfo = tempTowerInfo;
+        done = true;
+    });
+
+    if (ret == SYSTEM_ERROR_NONE) {
+        while(!done) {
+            if ((timeoutMs != 0) && (millis() - startMs >= timeoutMs)) {
+                QuectelTowerRK::instance().cancelScan();
+                ret = SYSTEM_ERROR_TIMEOUT;
+                break;
+            }
+            delay(1);
+        }
+    }
+    return ret;
+}
+
+static double threadCpuUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static long threadContextSwitches() {
+#ifdef RUSAGE_THREAD
+    struct rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+#else
+    return 0;
+#endif
+}
+
+template<typename Fn>
+static void run(const char *name, Fn scan) {
+    QuectelTowerRK::TowerInfo towerInfo;
+
+    double startCpuUs = threadCpuUs();
+    long startSwitches = threadContextSwitches();
+    auto startMs = millis();
+    for(int ii = 0; ii < NUM_SCANS; ii++) {
+        if (scan(towerInfo) != SYSTEM_ERROR_NONE || !towerInfo.isValid()) {
+            printf("%s: scan failed\n", name);
+            exit(1);
+        }
+    }
+    double cpuUs = (threadCpuUs() - startCpuUs) / NUM_SCANS;
+    double switches = (double)(threadContextSwitches() - startSwitches) / NUM_SCANS;
+    double wallMs = (double)(millis() - startMs) / NUM_SCANS;
+
+    printf("%-26s %8.1f us CPU/scan %8.1f context switches/scan %6.1f ms wall/scan\n", name, cpuUs, switches, wallMs);
+}
+
+int main() {
+    // A modem that takes a realistic time to answer
+    MockModem::setHandler([](const char *cmd, system_tick_t timeoutMs, const std::function<int(int, const char *, int)> &callback) {
+        if (strstr(cmd, "\"servingcell\"")) {
+            delay(SERVING_LATENCY_MS);
+        }
+        else if (strstr(cmd, "\"neighbourcell\"")) {
+            delay(NEIGHBOR_LATENCY_MS);
+        }
+        return MockModem::defaultHandler(cmd, timeoutMs, callback);
+    });
+
+    printf("%d scans, modem latency %lu ms per scan, CPU time of the calling thread only\n", NUM_SCANS, SERVING_LATENCY_MS + NEIGHBOR_LATENCY_MS);
+    run("polling delay(1) (0.0.2)", [](QuectelTowerRK::TowerInfo &towerInfo) { return pollingScanBlocking(towerInfo, 10000); });
+    run("semaphore scanBlocking()", [](QuectelTowerRK::TowerInfo &towerInfo) { return QuectelTowerRK::instance().scanBlocking(towerInfo, 10000); });
+
+    return 0;
+}
@@ -0,0 +1,191 @@
+// Benchmark of heap allocations made by TowerInfo::toVariant() and TowerDelta::toVariant(), against the
+// versions that built a temporary Variant for each tower and appended a copy of it
+
+#include "Particle.h"
+#include "QuectelTowerRK.h"
+
+#include <chrono>
+#include <new>
+
+static const int ITERATIONS = 20000;
+
+// Every allocation in the process goes through these, including the ones made by the mock Variant,
+// which stores arrays, maps, and strings on the heap like the Device OS one
+static std::atomic<bool> counting {false};
+static std::atomic<uint64_t> allocCount {0};
+static std::atomic<uint64_t> allocBytes {0};
+
+static void *countedAlloc(size_t size) {
+    if (counting) {
+        allocCount++;
+        allocBytes += size;
+    }
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *operator new(size_t size) { return countedAlloc(size); }
+void *operator new[](size_t size) { return countedAlloc(size); }
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete[](void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { free(ptr); }
+
+// The conversions before they filled Variants in place
+static void oldServingToVariant(const QuectelTowerRK::CellularServing &serving, Variant &obj) {
+    obj.set("rat", Variant("lte"));
+    obj.set("mcc", Variant((unsigned)serving.mcc));
+    obj.set("mnc", Variant((unsigned)serving.mnc));
+    obj.set("lac", Variant((unsigned)serving.lac));
+    obj.set("cid", Variant((unsigned)serving.cellId));
+    obj.set("str", Variant(serving.signalPower));
+}
+
+static void oldNeighborToVariant(const QuectelTowerRK::CellularNeighbor &neighbor, Variant &obj) {
+    obj.set("nid", Variant((unsigned)neighbor.neighborId));
+    obj.set("ch", Variant((unsigned)neighbor.earfcn));
+    obj.set("str", Variant(neighbor.signalPower));
+}
+
+static void oldTowerInfoToVariant(const QuectelTowerRK::TowerInfo &towerInfo, Variant &obj) {
+    if (towerInfo.serving.rat != QuectelTowerRK::RadioAccessTechnology::NONE) {
+        Variant obj2;
+        oldServingToVariant(towerInfo.serving, obj2);
+        obj.append(obj2);
+    }
+    for(const QuectelTowerRK::CellularNeighbor &neighbor : towerInfo.neighbors) {
+        Variant obj2;
+        oldNeighborToVariant(neighbor, obj2);
+        obj.append(obj2);
+    }
+}
+
+static void oldTowerDeltaToVariant(const QuectelTowerRK::TowerDelta &delta, Variant &obj) {
+    if (delta.servingChanged) {
+        Variant servingObj;
+        if (delta.serving.isValid()) {
+            oldServingToVariant(delta.serving, servingObj);
+        }
+        else {
+            servingObj = VariantMap();
+        }
+        obj.set("s", servingObj);
+    }
+    else if (delta.servingSignalChanged) {
+        obj.set("ss", Variant(delta.serving.signalPower));
+    }
+
+    const QuectelTowerRK::InlineVector<QuectelTowerRK::CellularNeighbor, QuectelTowerRK::MAX_NEIGHBORS> *lists[2] = {&delta.added, &delta.changed};
+    const char *listNames[2] = {"a", "c"};
+    for(size_t ii = 0; ii < 2; ii++) {
+        if (lists[ii]->empty()) {
+            continue;
+        }
+        Variant array;
+        for(const QuectelTowerRK::CellularNeighbor &neighbor : *lists[ii]) {
+            Variant entry;
+            entry.append(Variant((unsigned)neighbor.neighborId));
+            entry.append(Variant((unsigned)neighbor.earfcn));
+            entry.append(Variant(neighbor.signalPower));
+            array.append(entry);
+        }
+        obj.set(listNames[ii], array);
+    }
+
+    if (!delta.removed.empty()) {
+        Variant array;
+        for(const QuectelTowerRK::TowerDelta::NeighborKey &key : delta.removed) {
+            Variant entry;
+            entry.append(Variant((unsigned)key.neighborId));
+            entry.append(Variant((unsigned)key.earfcn));
+            array.append(entry);
+        }
+        obj.set("r", array);
+    }
+}
+
+static void makeTowerInfo(QuectelTowerRK::TowerInfo &towerInfo, uint32_t firstNeighborId, int numNeighbors, int signalOffset) {
+    towerInfo.clear();
+    towerInfo.serving.rat = QuectelTowerRK::RadioAccessTechnology::LTE_CAT_M1;
+    towerInfo.serving.mcc = 310;
+    towerInfo.serving.mnc = 410;
+    towerInfo.serving.lac = 0x1A2B;
+    towerInfo.serving.cellId = 0xA1B2C3D;
+    towerInfo.serving.signalPower = -95 + signalOffset;
+    for(int ii = 0; ii < numNeighbors; ii++) {
+        QuectelTowerRK::CellularNeighbor neighbor;
+        neighbor.rat = QuectelTowerRK::RadioAccessTechnology::LTE_CAT_M1;
+        neighbor.earfcn = 5110;
+        neighbor.neighborId = firstNeighborId + ii;
+        neighbor.signalPower = -100 - ii + signalOffset;
+        towerInfo.addNeighbor(neighbor);
+    }
+}
+
+/**
+ * @brief Run fn ITERATIONS times with a new Variant and print the allocations and time per call
+ */
+template<typename Fn>
+static void run(const char *name, Fn fn) {
+    allocCount = 0;
+    allocBytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int ii = 0; ii < ITERATIONS; ii++) {
+        Variant obj;
+        counting = true;
+        fn(obj);
+        counting = false;
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / ITERATIONS;
+
+    printf("%-28s %6.1f allocations %7.0f bytes %8.0f ns\n", name,
+        (double)allocCount / ITERATIONS, (double)allocBytes / ITERATIONS, ns);
+}
+
+int main() {
+    QuectelTowerRK::TowerInfo towerInfo, previous;
+    makeTowerInfo(towerInfo, 100, 8, 0);
+
+    // Neighbors added, removed, and changed, and a serving cell signal change
+    QuectelTowerRK::TowerDelta delta;
+    makeTowerInfo(previous, 96, 8, 10);
+    delta.compute(previous, towerInfo);
+
+    // Both versions must produce the same JSON
+    Variant oldObj, newObj;
+    oldTowerInfoToVariant(towerInfo, oldObj);
+    towerInfo.toVariant(newObj);
+    if (strcmp(oldObj.toJSON().c_str(), newObj.toJSON().c_str()) != 0) {
+        printf("TowerInfo results differ\n");
+        return 1;
+    }
+    // Also a new serving cell, and no serving cell
+    QuectelTowerRK::TowerInfo newServing, noServing;
+    makeTowerInfo(newServing, 100, 8, 0);
+    newServing.serving.cellId++;
+    QuectelTowerRK::TowerDelta otherDeltas[2];
+    otherDeltas[0].compute(towerInfo, newServing);
+    otherDeltas[1].compute(towerInfo, noServing);
+    for(const QuectelTowerRK::TowerDelta *checkDelta : {&delta, &otherDeltas[0], &otherDeltas[1]}) {
+        Variant oldDelta, newDelta;
+        oldTowerDeltaToVariant(*checkDelta, oldDelta);
+        checkDelta->toVariant(newDelta);
+        if (strcmp(oldDelta.toJSON().c_str(), newDelta.toJSON().c_str()) != 0) {
+            printf("TowerDelta results differ\n");
+            return 1;
+        }
+    }
+
+    Variant deltaObj;
+    delta.toVariant(deltaObj);
+    printf("serving cell and %d neighbors, delta %s\n", (int)towerInfo.neighbors.size(), deltaObj.toJSON().c_str());
+    run("TowerInfo copy (0.0.2)", [&](Variant &obj) { oldTowerInfoToVariant(towerInfo, obj); });
+    run("TowerInfo::toVariant()", [&](Variant &obj) { towerInfo.toVariant(obj); });
+    run("TowerDelta copy", [&](Variant &obj) { oldTowerDeltaToVariant(delta, obj); });
+    run("TowerDelta::toVariant()", [&](Variant &obj) { delta.toVariant(obj); });
+
+    return 0;
+}
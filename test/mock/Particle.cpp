@@ -0,0 +1,504 @@
+#include "Particle.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
+// Never destroyed, so detached worker threads can still use them while the process exits
+CellularClass &Cellular = *new CellularClass();
+SystemClass &System = *new SystemClass();
+
+std::atomic<bool> MockModem::isReady {true};
+std::atomic<int> MockModem::commandCount {0};
+std::atomic<int> MockModem::servingCellCount {0};
+std::atomic<int> MockModem::neighbourCellCount {0};
+std::atomic<int> MockModem::rssiCount {0};
+std::atomic<system_tick_t> MockModem::lastTimeoutMs {0};
+
+static std::mutex &modemMutex = *new std::mutex();
+static MockModem::Handler &modemHandler = *new MockModem::Handler();
+static int modemRssi = -95;
+
+//
+// String
+//
+String::String(const char *str) {
+    len = strlen(str);
+    buf = new char[len + 1];
+    memcpy(buf, str, len + 1);
+}
+
+String::String(const String &other) : String(other.c_str()) {
+}
+
+String::String(String &&other) noexcept : buf(other.buf), len(other.len) {
+    other.buf = nullptr;
+    other.len = 0;
+}
+
+String::~String() {
+    delete[] buf;
+}
+
+String &String::operator=(const String &other) {
+    if (this != &other) {
+        String temp(other);
+        *this = std::move(temp);
+    }
+    return *this;
+}
+
+String &String::operator=(String &&other) noexcept {
+    if (this != &other) {
+        delete[] buf;
+        buf = other.buf;
+        len = other.len;
+        other.buf = nullptr;
+        other.len = 0;
+    }
+    return *this;
+}
+
+// [static]
+String String::format(const char *fmt, ...) {
+    char temp[512];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(temp, sizeof(temp), fmt, ap);
+    va_end(ap);
+    return String(temp);
+}
+
+//
+// JSONWriter
+//
+JSONWriter &JSONWriter::beginArray() {
+    writeSeparator();
+    write("[", 1);
+    needSeparator = false;
+    return *this;
+}
+
+JSONWriter &JSONWriter::endArray() {
+    write("]", 1);
+    needSeparator = true;
+    return *this;
+}
+
+JSONWriter &JSONWriter::beginObject() {
+    writeSeparator();
+    write("{", 1);
+    needSeparator = false;
+    return *this;
+}
+
+JSONWriter &JSONWriter::endObject() {
+    write("}", 1);
+    needSeparator = true;
+    return *this;
+}
+
+JSONWriter &JSONWriter::name(const char *name) {
+    writeSeparator();
+    printf("\"%s\":", name);
+    needSeparator = false;
+    return *this;
+}
+
+JSONWriter &JSONWriter::value(bool val) {
+    writeSeparator();
+    printf("%s", val ? "true" : "false");
+    needSeparator = true;
+    return *this;
+}
+
+JSONWriter &JSONWriter::value(int val) {
+    writeSeparator();
+    printf("%d", val);
+    needSeparator = true;
+    return *this;
+}
+
+JSONWriter &JSONWriter::value(unsigned val) {
+    writeSeparator();
+    printf("%u", val);
+    needSeparator = true;
+    return *this;
+}
+
+JSONWriter &JSONWriter::value(double val) {
+    writeSeparator();
+    printf("%g", val);
+    needSeparator = true;
+    return *this;
+}
+
+JSONWriter &JSONWriter::value(const char *val) {
+    writeSeparator();
+    printf("\"%s\"", val);
+    needSeparator = true;
+    return *this;
+}
+
+void JSONWriter::writeSeparator() {
+    if (needSeparator) {
+        write(",", 1);
+    }
+}
+
+void JSONWriter::printf(const char *fmt, ...) {
+    char temp[64];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(temp, sizeof(temp), fmt, ap);
+    va_end(ap);
+    write(temp, (size_t)len);
+}
+
+void JSONBufferWriter::write(const char *data, size_t size) {
+    if (n < bufSize) {
+        memcpy(buf + n, data, std::min(size, bufSize - n));
+    }
+    n += size;
+}
+
+//
+// Variant
+//
+int Variant::size() const {
+    if (const VariantArray *array = std::get_if<VariantArray>(&value)) {
+        return array->size();
+    }
+    if (const VariantMap *map = std::get_if<VariantMap>(&value)) {
+        return map->size();
+    }
+    return 0;
+}
+
+VariantArray &Variant::asArray() {
+    if (!isArray()) {
+        value = VariantArray();
+    }
+    return std::get<VariantArray>(value);
+}
+
+VariantMap &Variant::asMap() {
+    if (!isMap()) {
+        value = VariantMap();
+    }
+    return std::get<VariantMap>(value);
+}
+
+Variant Variant::get(const char *key) const {
+    if (const VariantMap *map = std::get_if<VariantMap>(&value)) {
+        const Variant *val = map->find(String(key));
+        if (val) {
+            return *val;
+        }
+    }
+    return Variant();
+}
+
+Variant Variant::at(int index) const {
+    if (const VariantArray *array = std::get_if<VariantArray>(&value)) {
+        if (index >= 0 && index < array->size()) {
+            return array->at(index);
+        }
+    }
+    return Variant();
+}
+
+int64_t Variant::toInt() const {
+    if (const int64_t *val = std::get_if<int64_t>(&value)) {
+        return *val;
+    }
+    if (const uint64_t *val = std::get_if<uint64_t>(&value)) {
+        return (int64_t)*val;
+    }
+    return 0;
+}
+
+String Variant::toJSON() const {
+    std::string out;
+    toJSON(out);
+    return String(out.c_str());
+}
+
+void Variant::toJSON(std::string &out) const {
+    char temp[32];
+    switch(value.index()) {
+        case 0:
+            out += "null";
+            break;
+        case 1:
+            out += std::get<bool>(value) ? "true" : "false";
+            break;
+        case 2:
+            snprintf(temp, sizeof(temp), "%lld", (long long)std::get<int64_t>(value));
+            out += temp;
+            break;
+        case 3:
+            snprintf(temp, sizeof(temp), "%llu", (unsigned long long)std::get<uint64_t>(value));
+            out += temp;
+            break;
+        case 4:
+            snprintf(temp, sizeof(temp), "%g", std::get<double>(value));
+            out += temp;
+            break;
+        case 5:
+            out += "\"";
+            out += std::get<String>(value).c_str();
+            out += "\"";
+            break;
+        case 6: {
+            out += "[";
+            const VariantArray &array = std::get<VariantArray>(value);
+            for(int ii = 0; ii < array.size(); ii++) {
+                if (ii) {
+                    out += ",";
+                }
+                array.at(ii).toJSON(out);
+            }
+            out += "]";
+            break;
+        }
+        case 7: {
+            out += "{";
+            bool first = true;
+            for(const VariantMap::Entry &entry : std::get<VariantMap>(value).getEntries()) {
+                if (!first) {
+                    out += ",";
+                }
+                first = false;
+                out += "\"";
+                out += entry.first.c_str();
+                out += "\":";
+                entry.second.toJSON(out);
+            }
+            out += "}";
+            break;
+        }
+    }
+}
+
+//
+// Cellular
+//
+
+// [static]
+int MockModem::respond(const std::function<int(int, const char *, int)> &callback, const char *lines, size_t chunkSize) {
+    // Like the Device OS AT parser, each line is followed by CR LF
+    std::string data;
+    for(const char *cur = lines; *cur; ) {
+        const char *end = strchr(cur, '\n');
+        size_t len = end ? (size_t)(end - cur) : strlen(cur);
+        data.append(cur, len);
+        data += "\r\n";
+        cur += len + (end ? 1 : 0);
+    }
+
+    if (chunkSize == 0) {
+        chunkSize = data.size();
+    }
+    for(size_t offset = 0; offset < data.size(); offset += chunkSize) {
+        size_t len = std::min(chunkSize, data.size() - offset);
+        int type = (data[offset] == '+') ? TYPE_PLUS : TYPE_UNKNOWN;
+        int ret = callback(type, data.data() + offset, (int)len);
+        if (ret != WAIT) {
+            return ret;
+        }
+    }
+    return callback(TYPE_OK, "OK\r\n", 4);
+}
+
+// [static]
+int MockModem::defaultHandler(const char *cmd, system_tick_t timeoutMs, const std::function<int(int, const char *, int)> &callback) {
+    if (strstr(cmd, "AT+CGMM")) {
+        return respond(callback, "BG96");
+    }
+    if (strstr(cmd, "\"servingcell\"")) {
+        return respond(callback, "+QENG: \"servingcell\",\"NOCONN\",\"CAT-M\",\"FDD\",310,410,A1B2C3D,123,5110,12,3,3,1A2B,-95,-10,-65,15,28");
+    }
+    if (strstr(cmd, "\"neighbourcell\"")) {
+        return respond(callback,
+            "+QENG: \"neighbourcell intra\",\"CAT-M\",5110,200,-12,-101,-70,10,20\n"
+            "+QENG: \"neighbourcell inter\",\"CAT-M\",5230,301,-14,-108,-75,8,16");
+    }
+    return RESP_OK;
+}
+
+// [static]
+void MockModem::setHandler(Handler handler) {
+    std::lock_guard<std::mutex> lock(modemMutex);
+    modemHandler = std::move(handler);
+}
+
+// [static]
+void MockModem::setRssi(int rsrpDbm) {
+    std::lock_guard<std::mutex> lock(modemMutex);
+    modemRssi = rsrpDbm;
+}
+
+int CellularClass::mockCommand(const char *cmd, system_tick_t timeout, const std::function<int(int, const char *, int)> &callback) {
+    MockModem::Handler handler;
+    {
+        std::lock_guard<std::mutex> lock(modemMutex);
+        handler = modemHandler ? modemHandler : MockModem::defaultHandler;
+    }
+
+    MockModem::commandCount++;
+    MockModem::lastTimeoutMs = timeout;
+    if (strstr(cmd, "\"servingcell\"")) {
+        MockModem::servingCellCount++;
+    }
+    else if (strstr(cmd, "\"neighbourcell\"")) {
+        MockModem::neighbourCellCount++;
+    }
+    return handler(cmd, timeout, callback);
+}
+
+CellularSignal CellularClass::RSSI() {
+    int rsrp;
+    {
+        std::lock_guard<std::mutex> lock(modemMutex);
+        rsrp = modemRssi;
+    }
+    MockModem::rssiCount++;
+
+    cellular_signal_t sig = {};
+    sig.size = sizeof(sig);
+    sig.rat = 8;
+    sig.rsrp = rsrp * 100;
+    sig.strength = (rsrp != 0) ? (rsrp + 140) * 65535 / 96 : 0;
+
+    CellularSignal signal;
+    signal.fromHalCellularSignal(sig);
+    return signal;
+}
+
+//
+// System
+//
+uint64_t SystemClass::millis() {
+    static const auto start = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+    // Start at 1 so a timestamp is never 0
+    return 1 + (uint64_t)elapsed.count() + offsetMs;
+}
+
+void delay(unsigned long ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+long random(long max) {
+    return (max > 0) ? rand() % max : 0;
+}
+
+long random(long min, long max) {
+    return (max > min) ? min + rand() % (max - min) : min;
+}
+
+//
+// Concurrency
+//
+namespace {
+
+/**
+ * @brief Runs wait() on the condition variable until pred() is true or the Device OS style timeout expires
+ */
+template<typename Pred>
+bool waitFor(std::condition_variable &cv, std::unique_lock<std::mutex> &lock, system_tick_t timeout, Pred pred) {
+    if (timeout == CONCURRENT_WAIT_FOREVER) {
+        cv.wait(lock, pred);
+        return true;
+    }
+    return cv.wait_for(lock, std::chrono::milliseconds(timeout), pred);
+}
+
+struct MockQueue {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::vector<uint8_t>> items;
+    size_t itemSize;
+    size_t length;
+};
+
+struct MockSemaphore {
+    std::mutex mutex;
+    std::condition_variable cv;
+    unsigned count;
+    unsigned max;
+};
+
+} // namespace
+
+int os_queue_create(os_queue_t *queue, size_t itemSize, size_t length, void *reserved) {
+    MockQueue *q = new MockQueue();
+    q->itemSize = itemSize;
+    q->length = length;
+    *queue = q;
+    return 0;
+}
+
+int os_queue_put(os_queue_t queue, const void *item, system_tick_t delay, void *reserved) {
+    MockQueue *q = (MockQueue *)queue;
+    std::unique_lock<std::mutex> lock(q->mutex);
+    if (!waitFor(q->cv, lock, delay, [q]() { return q->items.size() < q->length; })) {
+        return 1;
+    }
+    q->items.emplace_back((const uint8_t *)item, (const uint8_t *)item + q->itemSize);
+    q->cv.notify_all();
+    return 0;
+}
+
+int os_queue_take(os_queue_t queue, void *item, system_tick_t delay, void *reserved) {
+    MockQueue *q = (MockQueue *)queue;
+    std::unique_lock<std::mutex> lock(q->mutex);
+    if (!waitFor(q->cv, lock, delay, [q]() { return !q->items.empty(); })) {
+        return 1;
+    }
+    memcpy(item, q->items.front().data(), q->itemSize);
+    q->items.pop_front();
+    q->cv.notify_all();
+    return 0;
+}
+
+int os_semaphore_create(os_semaphore_t *semaphore, unsigned max, unsigned initial) {
+    MockSemaphore *sem = new MockSemaphore();
+    sem->count = initial;
+    sem->max = max;
+    *semaphore = sem;
+    return 0;
+}
+
+int os_semaphore_destroy(os_semaphore_t semaphore) {
+    delete (MockSemaphore *)semaphore;
+    return 0;
+}
+
+int os_semaphore_take(os_semaphore_t semaphore, system_tick_t timeout, bool reserved) {
+    MockSemaphore *sem = (MockSemaphore *)semaphore;
+    std::unique_lock<std::mutex> lock(sem->mutex);
+    if (!waitFor(sem->cv, lock, timeout, [sem]() { return sem->count > 0; })) {
+        return 1;
+    }
+    sem->count--;
+    return 0;
+}
+
+int os_semaphore_give(os_semaphore_t semaphore, bool reserved) {
+    MockSemaphore *sem = (MockSemaphore *)semaphore;
+    std::lock_guard<std::mutex> lock(sem->mutex);
+    if (sem->count >= sem->max) {
+        return 1;
+    }
+    sem->count++;
+    sem->cv.notify_all();
+    return 0;
+}
+
+Thread::Thread(const char *name, std::function<void()> function, int priority, size_t stackSize) {
+    std::thread(std::move(function)).detach();
+}
@@ -0,0 +1,391 @@
+/*
+ * Minimal host (Linux/macOS) replacement for the Device OS API used by QuectelTowerRK, for the
+ * unit tests and benchmarks in this directory. It is not used when building for a device.
+ *
+ * Threads, queues, semaphores, and mutexes are real, built on the C++ standard library. The cellular
+ * modem is simulated: Cellular.command() calls a handler that tests can replace (see MockModem).
+ */
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#define SYSTEM_VERSION_v620
+
+typedef uint32_t system_tick_t;
+#define CONCURRENT_WAIT_FOREVER ((system_tick_t)-1)
+#define OS_THREAD_PRIORITY_DEFAULT 2
+#define OS_THREAD_STACK_SIZE_DEFAULT (3 * 1024)
+
+enum {
+    SYSTEM_ERROR_NONE = 0,
+    SYSTEM_ERROR_UNKNOWN = -100,
+    SYSTEM_ERROR_BUSY = -110,
+    SYSTEM_ERROR_NOT_SUPPORTED = -120,
+    SYSTEM_ERROR_CANCELLED = -140,
+    SYSTEM_ERROR_TIMEOUT = -160,
+    SYSTEM_ERROR_NOT_FOUND = -170,
+    SYSTEM_ERROR_TOO_LARGE = -190,
+    SYSTEM_ERROR_NOT_ENOUGH_DATA = -200,
+    SYSTEM_ERROR_INVALID_STATE = -210,
+    SYSTEM_ERROR_NO_MEMORY = -260,
+    SYSTEM_ERROR_INVALID_ARGUMENT = -270,
+    SYSTEM_ERROR_BAD_DATA = -280,
+};
+
+// Same meaning as Device OS system_error.h
+#define CHECK(_expr) do { const int _ret = (_expr); if (_ret < 0) { return _ret; } } while (false)
+#define CHECK_TRUE(_expr, _ret) do { if (!(_expr)) { return _ret; } } while (false)
+#define CHECK_FALSE(_expr, _ret) CHECK_TRUE(!(_expr), _ret)
+
+enum {
+    TYPE_UNKNOWN = 0x000000,
+    TYPE_OK = 0x110000,
+    TYPE_ERROR = 0x120000,
+    TYPE_PLUS = 0x150000,
+};
+
+enum {
+    WAIT = -1,
+    RESP_OK = -2,
+    RESP_ERROR = -3,
+};
+
+typedef int LogLevel;
+enum {
+    LOG_LEVEL_ALL = 1,
+    LOG_LEVEL_TRACE = 1,
+    LOG_LEVEL_INFO = 30,
+    LOG_LEVEL_WARN = 40,
+    LOG_LEVEL_ERROR = 50,
+};
+
+class Logger {
+public:
+    explicit Logger(const char *name) {}
+    void log(LogLevel level, const char *fmt, ...) const {}
+    void trace(const char *fmt, ...) const {}
+    void info(const char *fmt, ...) const {}
+    void warn(const char *fmt, ...) const {}
+    void error(const char *fmt, ...) const {}
+};
+
+/**
+ * @brief Like the Device OS String, this always allocates its buffer from the heap
+ */
+class String {
+public:
+    String(const char *str = "");
+    String(const String &other);
+    String(String &&other) noexcept;
+    ~String();
+    String &operator=(const String &other);
+    String &operator=(String &&other) noexcept;
+
+    static String format(const char *fmt, ...);
+
+    const char *c_str() const { return buf; }
+    size_t length() const { return len; }
+    bool operator==(const String &other) const { return len == other.len && memcmp(buf, other.buf, len) == 0; }
+    bool operator==(const char *str) const { return strcmp(buf, str) == 0; }
+
+protected:
+    char *buf = nullptr;
+    size_t len = 0;
+};
+
+class JSONWriter {
+public:
+    virtual ~JSONWriter() {}
+
+    JSONWriter &beginArray();
+    JSONWriter &endArray();
+    JSONWriter &beginObject();
+    JSONWriter &endObject();
+    JSONWriter &name(const char *name);
+    JSONWriter &value(bool val);
+    JSONWriter &value(int val);
+    JSONWriter &value(unsigned val);
+    JSONWriter &value(double val);
+    JSONWriter &value(const char *val);
+
+protected:
+    virtual void write(const char *data, size_t size) = 0;
+    void writeSeparator();
+    void printf(const char *fmt, ...);
+
+    bool needSeparator = false;
+};
+
+class JSONBufferWriter : public JSONWriter {
+public:
+    JSONBufferWriter(char *buf, size_t size) : buf(buf), bufSize(size) {}
+
+    char *buffer() const { return buf; }
+    size_t bufferSize() const { return bufSize; }
+    size_t dataSize() const { return n; } //!< Can be larger than bufferSize() if the data did not fit
+
+protected:
+    virtual void write(const char *data, size_t size) override;
+
+    char *buf;
+    size_t bufSize;
+    size_t n = 0;
+};
+
+class Variant;
+
+template<typename T>
+class Vector {
+public:
+    bool reserve(int n) { items.reserve(n); return true; }
+    bool append(const T &value) { items.push_back(value); return true; }
+    bool append(T &&value) { items.push_back(std::move(value)); return true; }
+    int size() const { return (int)items.size(); }
+    int capacity() const { return (int)items.capacity(); }
+    bool isEmpty() const { return items.empty(); }
+    T &at(int i) { return items.at(i); }
+    const T &at(int i) const { return items.at(i); }
+    T &operator[](int i) { return items[i]; }
+    const T &operator[](int i) const { return items[i]; }
+    T &last() { return items.back(); }
+    const T &last() const { return items.back(); }
+    T *begin() { return items.data(); }
+    T *end() { return items.data() + items.size(); }
+    const T *begin() const { return items.data(); }
+    const T *end() const { return items.data() + items.size(); }
+
+protected:
+    std::vector<T> items;
+};
+
+template<typename K, typename V>
+class Map {
+public:
+    typedef std::pair<K, V> Entry;
+
+    bool set(const K &key, V value) {
+        for(Entry &entry : entries) {
+            if (entry.first == key) {
+                entry.second = std::move(value);
+                return true;
+            }
+        }
+        return entries.append(Entry(key, std::move(value)));
+    }
+    V &operator[](const K &key) {
+        for(Entry &entry : entries) {
+            if (entry.first == key) {
+                return entry.second;
+            }
+        }
+        entries.append(Entry(key, V()));
+        return entries.last().second;
+    }
+    const V *find(const K &key) const {
+        for(const Entry &entry : entries) {
+            if (entry.first == key) {
+                return &entry.second;
+            }
+        }
+        return nullptr;
+    }
+    bool reserve(int n) { return entries.reserve(n); }
+    int size() const { return entries.size(); }
+    int capacity() const { return entries.capacity(); }
+    const Vector<Entry> &getEntries() const { return entries; }
+
+protected:
+    Vector<Entry> entries;
+};
+
+typedef Vector<Variant> VariantArray;
+typedef Map<String, Variant> VariantMap;
+
+/**
+ * @brief Same storage model as the Device OS Variant: copies are deep, arrays and maps are heap allocated
+ */
+class Variant {
+public:
+    Variant() {}
+    Variant(bool val) : value(val) {}
+    Variant(int val) : value((int64_t)val) {}
+    Variant(unsigned val) : value((uint64_t)val) {}
+    Variant(long val) : value((int64_t)val) {}
+    Variant(unsigned long val) : value((uint64_t)val) {}
+    Variant(long long val) : value((int64_t)val) {}
+    Variant(unsigned long long val) : value((uint64_t)val) {}
+    Variant(double val) : value(val) {}
+    Variant(const char *val) : value(String(val)) {}
+    Variant(const String &val) : value(val) {}
+    Variant(const VariantArray &val) : value(val) {}
+    Variant(const VariantMap &val) : value(val) {}
+
+    bool isNull() const { return value.index() == 0; }
+    bool isArray() const { return std::holds_alternative<VariantArray>(value); }
+    bool isMap() const { return std::holds_alternative<VariantMap>(value); }
+    int size() const;
+
+    VariantArray &asArray();
+    VariantMap &asMap();
+
+    bool append(const Variant &val) { return asArray().append(val); }
+    bool append(Variant &&val) { return asArray().append(std::move(val)); }
+    bool set(const char *key, const Variant &val) { return asMap().set(String(key), val); }
+    bool set(const String &key, const Variant &val) { return asMap().set(key, val); }
+    Variant get(const char *key) const;
+    Variant at(int index) const;
+
+    int64_t toInt() const;
+    String toJSON() const;
+
+protected:
+    void toJSON(std::string &out) const;
+
+    std::variant<std::monostate, bool, int64_t, uint64_t, double, String, VariantArray, VariantMap> value;
+};
+
+typedef int hal_net_access_tech_t;
+
+struct cellular_signal_t {
+    uint16_t size;
+    uint16_t version;
+    hal_net_access_tech_t rat;
+    int32_t rssi;
+    int32_t rscp;
+    int32_t ecno;
+    int32_t rsrq;
+    int32_t rsrp;
+    int32_t strength;
+    int32_t quality;
+};
+
+class CellularSignal {
+public:
+    virtual ~CellularSignal() {}
+
+    bool fromHalCellularSignal(const cellular_signal_t &sig) { this->sig = sig; return true; }
+    hal_net_access_tech_t getAccessTechnology() const { return sig.rat; }
+    float getStrength() const { return sig.strength * 100.0f / 65535; }
+    float getStrengthValue() const { return sig.rsrp / 100.0f; } //!< RSRP in dBm for LTE, 0 if not valid
+    float getQuality() const { return sig.quality * 100.0f / 65535; }
+    float getQualityValue() const { return sig.rsrq / 100.0f; }
+
+protected:
+    cellular_signal_t sig = {};
+};
+
+/**
+ * @brief Simulated cellular modem, replaceable by tests
+ */
+struct MockModem {
+    /**
+     * @brief Called for each Cellular.command(). Call callback with each response and return its result.
+     */
+    typedef std::function<int(const char *cmd, system_tick_t timeoutMs, const std::function<int(int, const char *, int)> &callback)> Handler;
+
+    /**
+     * @brief Respond to a command with lines of text followed by OK, like a working modem
+     *
+     * @param callback The callback passed to the handler
+     * @param lines Response lines, separated by \n
+     * @param chunkSize If not 0, split the response into chunks of this size, like the Device OS AT parser can
+     */
+    static int respond(const std::function<int(int, const char *, int)> &callback, const char *lines, size_t chunkSize = 0);
+
+    /**
+     * @brief The default handler, a BG96 with one serving cell and two neighbors
+     */
+    static int defaultHandler(const char *cmd, system_tick_t timeoutMs, const std::function<int(int, const char *, int)> &callback);
+
+    static void setHandler(Handler handler); //!< Replace the handler, nullptr for defaultHandler
+    static void setReady(bool ready) { isReady = ready; }
+    static void setRssi(int rsrpDbm); //!< Value returned by Cellular.RSSI(), 0 for an error
+
+    static std::atomic<bool> isReady; //!< Returned by Cellular.ready()
+    static std::atomic<int> commandCount; //!< Number of calls to Cellular.command()
+    static std::atomic<int> servingCellCount; //!< Number of AT+QENG="servingcell" commands
+    static std::atomic<int> neighbourCellCount; //!< Number of AT+QENG="neighbourcell" commands
+    static std::atomic<int> rssiCount; //!< Number of calls to Cellular.RSSI()
+    static std::atomic<system_tick_t> lastTimeoutMs; //!< timeout of the last Cellular.command()
+};
+
+class CellularClass {
+public:
+    bool ready() { return MockModem::isReady; }
+    CellularSignal RSSI();
+
+    template<typename T, typename... Args>
+    int command(int (*cb)(int, const char *, int, T *), T *param, system_tick_t timeout, const char *format, Args... args) {
+        char cmd[128];
+        snprintf(cmd, sizeof(cmd), format, args...);
+        return mockCommand(cmd, timeout, [cb, param](int type, const char *buf, int len) { return cb(type, buf, len, param); });
+    }
+
+protected:
+    int mockCommand(const char *cmd, system_tick_t timeout, const std::function<int(int, const char *, int)> &callback);
+};
+extern CellularClass &Cellular;
+
+class SystemClass {
+public:
+    uint64_t millis(); //!< Real elapsed time plus any mockAdvanceMillis()
+    unsigned uptime() { return (unsigned)(millis() / 1000); }
+
+    void mockAdvanceMillis(uint64_t ms) { offsetMs += ms; } //!< Make time jump forward, for testing timeouts
+
+protected:
+    std::atomic<uint64_t> offsetMs {0};
+};
+extern SystemClass &System;
+
+inline system_tick_t millis() { return (system_tick_t)System.millis(); }
+void delay(unsigned long ms);
+long random(long max);
+long random(long min, long max);
+
+class RecursiveMutex {
+public:
+    void lock() { mutex.lock(); }
+    void unlock() { mutex.unlock(); }
+    bool trylock() { return mutex.try_lock(); }
+    bool try_lock() { return mutex.try_lock(); }
+
+protected:
+    std::recursive_mutex mutex;
+};
+
+#define WITH_LOCK(lock) for (bool _with_lock_once = true; _with_lock_once; ) \
+    for (std::lock_guard<decltype(lock)> _with_lock_guard(lock); _with_lock_once; _with_lock_once = false)
+
+typedef void *os_queue_t;
+typedef void *os_semaphore_t;
+
+// Same return values as Device OS: 0 on success
+int os_queue_create(os_queue_t *queue, size_t itemSize, size_t length, void *reserved);
+int os_queue_put(os_queue_t queue, const void *item, system_tick_t delay, void *reserved);
+int os_queue_take(os_queue_t queue, void *item, system_tick_t delay, void *reserved);
+int os_semaphore_create(os_semaphore_t *semaphore, unsigned max, unsigned initial);
+int os_semaphore_destroy(os_semaphore_t semaphore);
+int os_semaphore_take(os_semaphore_t semaphore, system_tick_t timeout, bool reserved);
+int os_semaphore_give(os_semaphore_t semaphore, bool reserved);
+
+/**
+ * @brief Runs the function on a detached std::thread
+ */
+class Thread {
+public:
+    Thread(const char *name, std::function<void()> function, int priority = OS_THREAD_PRIORITY_DEFAULT, size_t stackSize = 0);
+    void cancel() {}
+};
@@ -0,0 +1,153 @@
+// Tests for QengLineAssembler: the same noisy modem response must parse the same way however it's split into callbacks
+
+#include "Particle.h"
+#include "QuectelTowerRK.h"
+#include "test.h"
+
+#include <string>
+
+// A servingcell response, a URC, blank lines, a line too long for the buffer, two responses merged
+// onto one line after a lost line terminator, and a last line with no terminator
+static const char noisyResponse[] =
+    "\r\n"
+    "+QENG: \"servingcell\",\"NOCONN\",\"LTE\",\"FDD\",310,410,A1B2C3D,123,5110,12,3,3,1A2B,-95,-10,-65,15,28\r\n"
+    "+CREG: 1\r\n"
+    "\r\n"
+    "+QENG: \"neighbourcell intra\",\"LTE\",5110,321,-12,-101,-70,10,20,0,0,0,0\r\n"
+    "+QENG: \"neighbourcell intra\",\"LTE\",5110,999,-12,-101,-70,10,20,0,0,0,0,xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx"
+        "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx\r\n"
+    "+QENG: \"neighbourcell inter\",\"LTE\",5035,17,-15,-110,-80,-,-,-,-"
+        "+QENG: \"neighbourcell inter\",\"LTE\",5036,18,-15,-111,-80,-,-,-,-\r\n"
+    "\n"
+    "+QENG: \"neighbourcell inter\",\"LTE\",5037,19,-16,-112,-81";
+
+static void checkResult(const QuectelTowerRK::TowerInfo &towerInfo) {
+    TEST_ASSERT(towerInfo.serving.isValid());
+    TEST_ASSERT_EQUAL(310, towerInfo.serving.mcc);
+    TEST_ASSERT_EQUAL(410, towerInfo.serving.mnc);
+    TEST_ASSERT_EQUAL(0xA1B2C3D, towerInfo.serving.cellId);
+    TEST_ASSERT_EQUAL(0x1A2B, towerInfo.serving.lac);
+    TEST_ASSERT_EQUAL(-95, towerInfo.serving.rsrp);
+    TEST_ASSERT_EQUAL(28, towerInfo.serving.srxlev);
+
+    // The too long line (neighbor ID 999) is discarded
+    static const uint32_t expectedIds[] = {321, 17, 18, 19};
+    static const uint32_t expectedChannels[] = {5110, 5035, 5036, 5037};
+    TEST_ASSERT_EQUAL(4, towerInfo.neighbors.size());
+    for(size_t ii = 0; ii < 4; ii++) {
+        TEST_ASSERT_EQUAL(expectedIds[ii], towerInfo.neighbors[ii].neighborId);
+        TEST_ASSERT_EQUAL(expectedChannels[ii], towerInfo.neighbors[ii].earfcn);
+    }
+    TEST_ASSERT_EQUAL(-112, towerInfo.neighbors[3].signalPower);
+}
+
+/**
+ * @brief Feed the response in chunks ending at the offsets in splits, then flush
+ */
+static void parseSplit(const std::vector<size_t> &splits, QuectelTowerRK::TowerInfo &towerInfo) {
+    QuectelTowerRK::QengLineAssembler assembler;
+    assembler.reset();
+
+    size_t offset = 0;
+    for(size_t split : splits) {
+        assembler.feed(&noisyResponse[offset], split - offset, towerInfo);
+        offset = split;
+    }
+    assembler.feed(&noisyResponse[offset], sizeof(noisyResponse) - 1 - offset, towerInfo);
+    assembler.flush(towerInfo);
+}
+
+static void testWhole() {
+    QuectelTowerRK::TowerInfo towerInfo;
+    parseSplit({}, towerInfo);
+    checkResult(towerInfo);
+}
+
+static void testEveryTwoWaySplit() {
+    for(size_t split = 0; split < sizeof(noisyResponse); split++) {
+        QuectelTowerRK::TowerInfo towerInfo;
+        parseSplit({split}, towerInfo);
+        checkResult(towerInfo);
+    }
+}
+
+static void testRandomSplits() {
+    const size_t len = sizeof(noisyResponse) - 1;
+    srand(3);
+
+    for(int iter = 0; iter < 20000; iter++) {
+        // Mostly small chunks, sometimes empty ones, and sometimes large ones
+        std::vector<size_t> splits;
+        size_t offset = 0;
+        while(true) {
+            size_t chunk;
+            switch(rand() % 4) {
+                case 0: chunk = 0; break;
+                case 1: chunk = 1; break;
+                case 2: chunk = 1 + rand() % 16; break;
+                default: chunk = 1 + rand() % 200; break;
+            }
+            offset += chunk;
+            if (offset >= len) {
+                break;
+            }
+            splits.push_back(offset);
+        }
+
+        QuectelTowerRK::TowerInfo towerInfo;
+        parseSplit(splits, towerInfo);
+        checkResult(towerInfo);
+    }
+}
+
+static void testResetDiscardsPartialLine() {
+    QuectelTowerRK::TowerInfo towerInfo;
+    QuectelTowerRK::QengLineAssembler assembler;
+    assembler.reset();
+
+    // A partial line left over from a command that timed out must not be joined to the next response
+    static const char partial[] = "+QENG: \"neighbourcell intra\",\"LTE\",5110,3";
+    assembler.feed(partial, sizeof(partial) - 1, towerInfo);
+    assembler.reset();
+    assembler.feed(noisyResponse, sizeof(noisyResponse) - 1, towerInfo);
+    assembler.flush(towerInfo);
+    checkResult(towerInfo);
+}
+
+static void testScanWithChunkedCallbacks() {
+    // The whole path through Cellular.command callbacks, with the modem splitting every response
+    static size_t chunkSize;
+    MockModem::setHandler([](const char *cmd, system_tick_t timeoutMs, const std::function<int(int, const char *, int)> &callback) {
+        if (strstr(cmd, "\"servingcell\"")) {
+            return MockModem::respond(callback,
+                "+QENG: \"servingcell\",\"NOCONN\",\"LTE\",\"FDD\",310,410,A1B2C3D,123,5110,12,3,3,1A2B,-95,-10,-65,15,28\n"
+                "+CREG: 1", chunkSize);
+        }
+        if (strstr(cmd, "\"neighbourcell\"")) {
+            return MockModem::respond(callback,
+                "+QENG: \"neighbourcell intra\",\"LTE\",5110,321,-12,-101,-70,10,20,0,0,0,0\n"
+                "+QENG: \"neighbourcell inter\",\"LTE\",5035,17,-15,-110,-80,-,-,-,-", chunkSize);
+        }
+        return MockModem::defaultHandler(cmd, timeoutMs, callback);
+    });
+
+    for(chunkSize = 1; chunkSize <= 64; chunkSize++) {
+        QuectelTowerRK::TowerInfo towerInfo;
+        TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, QuectelTowerRK::instance().scanBlocking(towerInfo, 5000));
+        TEST_ASSERT(towerInfo.status == QuectelTowerRK::ScanStatus::COMPLETE);
+        TEST_ASSERT_EQUAL(0xA1B2C3D, towerInfo.serving.cellId);
+        TEST_ASSERT_EQUAL(2, towerInfo.neighbors.size());
+        TEST_ASSERT_EQUAL(17, towerInfo.neighbors[1].neighborId);
+    }
+    MockModem::setHandler(nullptr);
+}
+
+int main() {
+    testWhole();
+    testEveryTwoWaySplit();
+    testRandomSplits();
+    testResetDiscardsPartialLine();
+    testScanWithChunkedCallbacks();
+    printf("test-assembler passed\n");
+    return 0;
+}
@@ -0,0 +1,207 @@
+// Tests for TowerInfo::toCbor() and fromCbor(), and the host decoder in QuectelTowerCbor.h
+
+#include "Particle.h"
+#include "QuectelTowerRK.h"
+#include "QuectelTowerCbor.h"
+#include "test.h"
+
+#include <string>
+
+static QuectelTowerRK::CellularNeighbor makeNeighbor(uint32_t earfcn, uint32_t neighborId, int signalPower) {
+    QuectelTowerRK::CellularNeighbor neighbor;
+    neighbor.rat = QuectelTowerRK::RadioAccessTechnology::LTE_CAT_M1;
+    neighbor.earfcn = earfcn;
+    neighbor.neighborId = neighborId;
+    neighbor.signalPower = signalPower;
+    return neighbor;
+}
+
+/**
+ * @brief A scan with values that need every integer size: 1, 2, and 4 byte arguments, and negative values
+ */
+static void makeTowerInfo(QuectelTowerRK::TowerInfo &towerInfo) {
+    towerInfo.clear();
+    towerInfo.serving.rat = QuectelTowerRK::RadioAccessTechnology::LTE_CAT_M1;
+    towerInfo.serving.mcc = 310;
+    towerInfo.serving.mnc = 410;
+    towerInfo.serving.lac = 0x1A2B;
+    towerInfo.serving.cellId = 0xA1B2C3D;
+    towerInfo.serving.signalPower = -95;
+    towerInfo.addNeighbor(makeNeighbor(5110, 321, -101));
+    towerInfo.addNeighbor(makeNeighbor(5035, 17, -110));
+    towerInfo.addNeighbor(makeNeighbor(70000, 3, -24));
+    towerInfo.addNeighbor(makeNeighbor(9, 0, 0));
+}
+
+static std::string toJson(const QuectelTowerRK::TowerInfo &towerInfo) {
+    char buf[1024];
+    JSONBufferWriter writer(buf, sizeof(buf));
+    towerInfo.toJsonWriter(writer);
+    TEST_ASSERT(writer.dataSize() < sizeof(buf));
+    return std::string(buf, writer.dataSize());
+}
+
+static void testRoundTrip() {
+    QuectelTowerRK::TowerInfo towerInfo, decoded;
+    makeTowerInfo(towerInfo);
+
+    uint8_t buf[256];
+    int size = towerInfo.toCbor(buf, sizeof(buf));
+    TEST_ASSERT(size > 0);
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, decoded.fromCbor(buf, size));
+    TEST_ASSERT(decoded.serving.rat == QuectelTowerRK::RadioAccessTechnology::LTE_CAT_M1);
+    TEST_ASSERT_EQUAL(4, decoded.neighbors.size());
+    TEST_ASSERT(decoded.neighbors[0].rat == QuectelTowerRK::RadioAccessTechnology::LTE_CAT_M1);
+    TEST_ASSERT(toJson(towerInfo) == toJson(decoded));
+
+    // Limited to the serving cell and the two strongest neighbors
+    size = towerInfo.toCbor(buf, sizeof(buf), 3);
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, decoded.fromCbor(buf, size));
+    TEST_ASSERT_EQUAL(2, decoded.neighbors.size());
+    TEST_ASSERT_EQUAL(0, decoded.neighbors[0].signalPower);
+    TEST_ASSERT_EQUAL(-24, decoded.neighbors[1].signalPower);
+
+    // Neighbors only
+    QuectelTowerRK::TowerInfo neighborsOnly;
+    neighborsOnly.addNeighbor(makeNeighbor(5110, 321, -101));
+    size = neighborsOnly.toCbor(buf, sizeof(buf));
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, decoded.fromCbor(buf, size));
+    TEST_ASSERT(!decoded.serving.isValid());
+    TEST_ASSERT_EQUAL(1, decoded.neighbors.size());
+    TEST_ASSERT(decoded.neighbors[0].rat == QuectelTowerRK::RadioAccessTechnology::LTE);
+}
+
+static void testBufferTooSmall() {
+    QuectelTowerRK::TowerInfo towerInfo;
+    makeTowerInfo(towerInfo);
+
+    uint8_t buf[256];
+    int size = towerInfo.toCbor(buf, sizeof(buf));
+    for(int bufSize = 0; bufSize < size; bufSize++) {
+        uint8_t small[256];
+        memset(small, 0xAA, sizeof(small));
+        TEST_ASSERT_EQUAL(SYSTEM_ERROR_TOO_LARGE, towerInfo.toCbor(small, bufSize));
+        TEST_ASSERT_EQUAL(0xAA, small[bufSize]);
+    }
+    TEST_ASSERT_EQUAL(size, towerInfo.toCbor(buf, size));
+}
+
+static void testTruncated() {
+    QuectelTowerRK::TowerInfo towerInfo, decoded;
+    makeTowerInfo(towerInfo);
+
+    uint8_t buf[256];
+    int size = towerInfo.toCbor(buf, sizeof(buf));
+    for(int len = 0; len < size; len++) {
+        makeTowerInfo(decoded);
+        TEST_ASSERT_EQUAL(SYSTEM_ERROR_BAD_DATA, decoded.fromCbor(buf, len));
+        TEST_ASSERT(!decoded.serving.isValid());
+        TEST_ASSERT_EQUAL(0, decoded.neighbors.size());
+    }
+
+    // Trailing data is not valid either
+    buf[size] = 0;
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_BAD_DATA, decoded.fromCbor(buf, size + 1));
+}
+
+static void testUnknownKeys() {
+    // [{4: 0x1234, 0: 8, 256: 5, 260: 9, 5: -80, 99: -1}]
+    // 256 and 260 must not be taken as keys 0 (rat) and 4 (cid)
+    static const uint8_t data[] = {
+        0x81, 0xa6,
+        0x04, 0x19, 0x12, 0x34,
+        0x00, 0x08,
+        0x19, 0x01, 0x00, 0x05,
+        0x19, 0x01, 0x04, 0x09,
+        0x05, 0x38, 0x4f,
+        0x18, 0x63, 0x20,
+    };
+    QuectelTowerRK::TowerInfo decoded;
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, decoded.fromCbor(data, sizeof(data)));
+    TEST_ASSERT(decoded.serving.rat == QuectelTowerRK::RadioAccessTechnology::LTE_CAT_M1);
+    TEST_ASSERT_EQUAL(0x1234, decoded.serving.cellId);
+    TEST_ASSERT_EQUAL(-80, decoded.serving.signalPower);
+    TEST_ASSERT_EQUAL(0, decoded.neighbors.size());
+}
+
+static void testClearsOtherFields() {
+    QuectelTowerRK::TowerInfo towerInfo, decoded;
+    makeTowerInfo(towerInfo);
+
+    // A scan result with the neighbor list overflowed
+    decoded.clear();
+    for(uint32_t ii = 0; ii < QuectelTowerRK::MAX_NEIGHBORS + 3; ii++) {
+        decoded.addNeighbor(makeNeighbor(100, ii, -100 - (int)ii));
+    }
+    decoded.status = QuectelTowerRK::ScanStatus::COMPLETE;
+    decoded.contents = QuectelTowerRK::ScanOptions::ALL;
+    decoded.updatedMs = 1234;
+    TEST_ASSERT_EQUAL(3, decoded.neighborsDiscarded);
+
+    uint8_t buf[256];
+    int size = towerInfo.toCbor(buf, sizeof(buf));
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, decoded.fromCbor(buf, size));
+    TEST_ASSERT(decoded.status == QuectelTowerRK::ScanStatus::NONE);
+    TEST_ASSERT(decoded.contents == QuectelTowerRK::ScanOptions::NONE);
+    TEST_ASSERT_EQUAL(0, decoded.updatedMs);
+    TEST_ASSERT_EQUAL(0, decoded.neighborsDiscarded);
+
+    // The duplicate table matches the decoded neighbors, so a duplicate is still found
+    QuectelTowerRK::TowerInfo single, decodedSingle;
+    single.addNeighbor(makeNeighbor(5110, 321, -101));
+    size = single.toCbor(buf, sizeof(buf));
+    decodedSingle.addNeighbor(makeNeighbor(1, 1, -90));
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, decodedSingle.fromCbor(buf, size));
+    QuectelTowerRK::CellularNeighbor duplicate = makeNeighbor(5110, 321, -80);
+    duplicate.rat = QuectelTowerRK::RadioAccessTechnology::LTE; // Neighbors decoded without a serving cell
+    decodedSingle.addNeighbor(duplicate);
+    TEST_ASSERT_EQUAL(1, decodedSingle.neighbors.size());
+    TEST_ASSERT_EQUAL(-80, decodedSingle.neighbors[0].signalPower);
+}
+
+static void testHostDecoder() {
+    QuectelTowerRK::TowerInfo towerInfo;
+    makeTowerInfo(towerInfo);
+
+    uint8_t buf[256];
+    int size = towerInfo.toCbor(buf, sizeof(buf));
+
+    int numTowers = 0;
+    TEST_ASSERT(QuectelTowerCbor::decode(buf, size, [&numTowers](const QuectelTowerCbor::Tower &tower) {
+        if (numTowers++ == 0) {
+            TEST_ASSERT(tower.isServing);
+            TEST_ASSERT_EQUAL((int)QuectelTowerRK::RadioAccessTechnology::LTE_CAT_M1, tower.rat);
+            TEST_ASSERT_EQUAL(0xA1B2C3D, tower.cellId);
+        }
+        else {
+            TEST_ASSERT(!tower.isServing);
+        }
+        return true;
+    }));
+    TEST_ASSERT_EQUAL(5, numTowers);
+    TEST_ASSERT(!QuectelTowerCbor::decode(buf, size - 1, [](const QuectelTowerCbor::Tower &tower) { return true; }));
+
+    // The tools/cbor2json example, built without the Device OS mock, gives the same JSON as toJsonWriter()
+    FILE *fp = fopen("build/towers.cbor", "wb");
+    TEST_ASSERT(fp != nullptr);
+    fwrite(buf, 1, size, fp);
+    fclose(fp);
+
+    fp = popen("build/cbor2json < build/towers.cbor", "r");
+    TEST_ASSERT(fp != nullptr);
+    char json[1024] = {};
+    TEST_ASSERT(fgets(json, sizeof(json), fp) != nullptr);
+    TEST_ASSERT_EQUAL(0, pclose(fp));
+    TEST_ASSERT(toJson(towerInfo) + "\n" == json);
+}
+
+int main() {
+    testRoundTrip();
+    testBufferTooSmall();
+    testTruncated();
+    testUnknownKeys();
+    testClearsOtherFields();
+    testHostDecoder();
+    printf("test-cbor passed\n");
+    return 0;
+}
@@ -0,0 +1,205 @@
+// Tests for TowerDelta: compute() and apply() round trips, the signal threshold, and the JSON format
+// that the applyDelta() example in README.md reads
+
+#include "Particle.h"
+#include "QuectelTowerRK.h"
+#include "test.h"
+
+#include <algorithm>
+#include <string>
+#include <tuple>
+#include <vector>
+
+static QuectelTowerRK::CellularNeighbor makeNeighbor(uint32_t earfcn, uint32_t neighborId, int signalPower) {
+    QuectelTowerRK::CellularNeighbor neighbor;
+    neighbor.rat = QuectelTowerRK::RadioAccessTechnology::LTE_CAT_M1;
+    neighbor.earfcn = earfcn;
+    neighbor.neighborId = neighborId;
+    neighbor.signalPower = signalPower;
+    return neighbor;
+}
+
+static void makeServing(QuectelTowerRK::TowerInfo &towerInfo, uint32_t cellId, int signalPower) {
+    towerInfo.serving.rat = QuectelTowerRK::RadioAccessTechnology::LTE_CAT_M1;
+    towerInfo.serving.mcc = 310;
+    towerInfo.serving.mnc = 410;
+    towerInfo.serving.lac = 0x1A2B;
+    towerInfo.serving.cellId = cellId;
+    towerInfo.serving.signalPower = signalPower;
+}
+
+static std::string toJson(const QuectelTowerRK::TowerDelta &delta) {
+    char buf[1024];
+    JSONBufferWriter writer(buf, sizeof(buf));
+    delta.toJsonWriter(writer);
+    TEST_ASSERT(writer.dataSize() < sizeof(buf));
+    return std::string(buf, writer.dataSize());
+}
+
+/**
+ * @brief The towers that the JSON contains, as the receiver sees them. Neighbor order does not matter.
+ */
+static bool sameTowers(const QuectelTowerRK::TowerInfo &a, const QuectelTowerRK::TowerInfo &b) {
+    if (a.serving.isValid() != b.serving.isValid()) {
+        return false;
+    }
+    if (a.serving.isValid() && (!a.serving.isSameCell(b.serving) || a.serving.signalPower != b.serving.signalPower)) {
+        return false;
+    }
+    std::vector<std::tuple<uint32_t, uint32_t, int>> aNeighbors, bNeighbors;
+    for(const QuectelTowerRK::CellularNeighbor &neighbor : a.neighbors) {
+        aNeighbors.emplace_back(neighbor.earfcn, neighbor.neighborId, neighbor.signalPower);
+    }
+    for(const QuectelTowerRK::CellularNeighbor &neighbor : b.neighbors) {
+        bNeighbors.emplace_back(neighbor.earfcn, neighbor.neighborId, neighbor.signalPower);
+    }
+    std::sort(aNeighbors.begin(), aNeighbors.end());
+    std::sort(bNeighbors.begin(), bNeighbors.end());
+    return aNeighbors == bNeighbors;
+}
+
+static void testFromEmpty() {
+    QuectelTowerRK::TowerInfo empty, current, rebuilt;
+    makeServing(current, 0xA1B2C3D, -95);
+    current.addNeighbor(makeNeighbor(5110, 200, -101));
+    current.addNeighbor(makeNeighbor(5230, 301, -108));
+
+    // Everything is new
+    QuectelTowerRK::TowerDelta delta;
+    delta.compute(empty, current);
+    TEST_ASSERT(!delta.isEmpty());
+    TEST_ASSERT(toJson(delta) == "{\"s\":{\"rat\":\"lte\",\"mcc\":310,\"mnc\":410,\"lac\":6699,\"cid\":169552957,\"str\":-95},"
+        "\"a\":[[200,5110,-101],[301,5230,-108]]}");
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, delta.apply(rebuilt));
+    TEST_ASSERT(sameTowers(current, rebuilt));
+
+    // No changes
+    delta.compute(rebuilt, current);
+    TEST_ASSERT(delta.isEmpty());
+    TEST_ASSERT(toJson(delta) == "{}");
+}
+
+static void testThreshold() {
+    QuectelTowerRK::TowerInfo previous, current;
+    makeServing(previous, 0xA1B2C3D, -95);
+    previous.addNeighbor(makeNeighbor(5110, 200, -101));
+    previous.addNeighbor(makeNeighbor(5230, 301, -108));
+
+    // Changes smaller than the threshold are not reported
+    makeServing(current, 0xA1B2C3D, -93);
+    current.addNeighbor(makeNeighbor(5110, 200, -103));
+    current.addNeighbor(makeNeighbor(5230, 301, -106));
+    QuectelTowerRK::TowerDelta delta;
+    delta.compute(previous, current);
+    TEST_ASSERT(delta.isEmpty());
+
+    // At the threshold they are, and only the serving cell signal is sent
+    current.serving.signalPower = -92;
+    current.neighbors[0].signalPower = -104;
+    delta.compute(previous, current);
+    TEST_ASSERT(delta.servingSignalChanged && !delta.servingChanged);
+    TEST_ASSERT(toJson(delta) == "{\"ss\":-92,\"c\":[[200,5110,-104]]}");
+
+    QuectelTowerRK::TowerInfo rebuilt = previous;
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, delta.apply(rebuilt));
+    TEST_ASSERT_EQUAL(-92, rebuilt.serving.signalPower);
+    TEST_ASSERT_EQUAL(-104, rebuilt.neighbors[0].signalPower);
+    TEST_ASSERT_EQUAL(-108, rebuilt.neighbors[1].signalPower);
+
+    // A custom threshold
+    delta.compute(previous, current, 1);
+    TEST_ASSERT(toJson(delta) == "{\"ss\":-92,\"c\":[[200,5110,-104],[301,5230,-106]]}");
+    delta.compute(previous, current, 10);
+    TEST_ASSERT(delta.isEmpty());
+}
+
+static void testAddRemove() {
+    QuectelTowerRK::TowerInfo previous, current;
+    makeServing(previous, 0xA1B2C3D, -95);
+    previous.addNeighbor(makeNeighbor(5110, 200, -101));
+    previous.addNeighbor(makeNeighbor(5230, 301, -108));
+    previous.addNeighbor(makeNeighbor(5230, 302, -110));
+
+    // A new serving cell, one neighbor removed, one added, and one with the same ID on another channel
+    makeServing(current, 0xA1B2C3E, -90);
+    current.addNeighbor(makeNeighbor(5230, 302, -110));
+    current.addNeighbor(makeNeighbor(5110, 400, -100));
+    current.addNeighbor(makeNeighbor(5110, 301, -99));
+    current.addNeighbor(makeNeighbor(5110, 200, -111));
+
+    QuectelTowerRK::TowerDelta delta;
+    delta.compute(previous, current);
+    TEST_ASSERT(toJson(delta) == "{\"s\":{\"rat\":\"lte\",\"mcc\":310,\"mnc\":410,\"lac\":6699,\"cid\":169552958,\"str\":-90},"
+        "\"a\":[[400,5110,-100],[301,5110,-99]],\"c\":[[200,5110,-111]],\"r\":[[301,5230]]}");
+
+    QuectelTowerRK::TowerInfo rebuilt = previous;
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, delta.apply(rebuilt));
+    TEST_ASSERT(sameTowers(current, rebuilt));
+
+    // Everything removed, including the serving cell
+    QuectelTowerRK::TowerInfo empty;
+    delta.compute(current, empty);
+    TEST_ASSERT(toJson(delta) == "{\"s\":{},\"r\":[[302,5230],[400,5110],[301,5110],[200,5110]]}");
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, delta.apply(rebuilt));
+    TEST_ASSERT(sameTowers(empty, rebuilt));
+    TEST_ASSERT_EQUAL(0, rebuilt.neighbors.size());
+}
+
+static void testApplyToWrongState() {
+    QuectelTowerRK::TowerInfo previous, current, other;
+    makeServing(previous, 0xA1B2C3D, -95);
+    previous.addNeighbor(makeNeighbor(5110, 200, -101));
+    previous.addNeighbor(makeNeighbor(5230, 301, -108));
+    makeServing(current, 0xA1B2C3D, -95);
+    current.addNeighbor(makeNeighbor(5110, 200, -90));
+    current.addNeighbor(makeNeighbor(5110, 500, -100));
+
+    QuectelTowerRK::TowerDelta delta;
+    delta.compute(previous, current);
+
+    // The changed and removed neighbors are not there, but the rest is still applied
+    makeServing(other, 0xA1B2C3D, -95);
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NOT_FOUND, delta.apply(other));
+    TEST_ASSERT_EQUAL(1, other.neighbors.size());
+    TEST_ASSERT_EQUAL(500, other.neighbors[0].neighborId);
+}
+
+static void testRepeatedRoundTrips() {
+    // Deltas computed from the rebuilt state, as the receiver has it, stay within the threshold of each scan
+    QuectelTowerRK::TowerInfo sent;
+    uint32_t seed = 1;
+    for(int scan = 0; scan < 200; scan++) {
+        QuectelTowerRK::TowerInfo current;
+        seed = seed * 1103515245 + 12345;
+        makeServing(current, 0xA1B2C3D + (seed >> 28) % 2, -95 + (int)((seed >> 8) % 7));
+        for(uint32_t ii = 0; ii < 6; ii++) {
+            seed = seed * 1103515245 + 12345;
+            if ((seed >> 16) % 3 != 0) {
+                current.addNeighbor(makeNeighbor(5110 + (ii % 2) * 120, 200 + ii, -110 + (int)((seed >> 8) % 9)));
+            }
+        }
+
+        QuectelTowerRK::TowerDelta delta;
+        delta.compute(sent, current);
+        TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, delta.apply(sent));
+
+        TEST_ASSERT(sent.serving.isSameCell(current.serving));
+        TEST_ASSERT(abs(sent.serving.signalPower - current.serving.signalPower) < QuectelTowerRK::TowerDelta::DEFAULT_SIGNAL_THRESHOLD);
+        TEST_ASSERT_EQUAL(current.neighbors.size(), sent.neighbors.size());
+        for(const QuectelTowerRK::CellularNeighbor &neighbor : current.neighbors) {
+            int index = sent.findNeighbor(neighbor.earfcn, neighbor.neighborId);
+            TEST_ASSERT(index >= 0);
+            TEST_ASSERT(abs(sent.neighbors[index].signalPower - neighbor.signalPower) < QuectelTowerRK::TowerDelta::DEFAULT_SIGNAL_THRESHOLD);
+        }
+    }
+}
+
+int main() {
+    testFromEmpty();
+    testThreshold();
+    testAddRemove();
+    testApplyToWrongState();
+    testRepeatedRoundTrips();
+    printf("test-delta passed\n");
+    return 0;
+}
@@ -0,0 +1,159 @@
+// Tests for TowerInfo::addNeighbor(): duplicates, the serving cell, and the overflow policy
+
+#include "Particle.h"
+#include "QuectelTowerRK.h"
+#include "test.h"
+
+#include <algorithm>
+#include <vector>
+
+static QuectelTowerRK::CellularNeighbor makeNeighbor(uint32_t earfcn, uint32_t neighborId, int signalPower, int signalQuality = -10) {
+    QuectelTowerRK::CellularNeighbor neighbor;
+    neighbor.rat = QuectelTowerRK::RadioAccessTechnology::LTE_CAT_M1;
+    neighbor.earfcn = earfcn;
+    neighbor.neighborId = neighborId;
+    neighbor.signalPower = signalPower;
+    neighbor.signalQuality = signalQuality;
+    return neighbor;
+}
+
+static void testDuplicates() {
+    QuectelTowerRK::TowerInfo towerInfo;
+    TEST_ASSERT(towerInfo.addNeighbor(makeNeighbor(5110, 200, -100)));
+    TEST_ASSERT(towerInfo.addNeighbor(makeNeighbor(5230, 301, -108)));
+
+    // A weaker duplicate is discarded, a stronger one replaces it in place
+    TEST_ASSERT(!towerInfo.addNeighbor(makeNeighbor(5110, 200, -105)));
+    TEST_ASSERT_EQUAL(2, towerInfo.neighbors.size());
+    TEST_ASSERT_EQUAL(-100, towerInfo.neighbors[0].signalPower);
+    TEST_ASSERT(towerInfo.addNeighbor(makeNeighbor(5110, 200, -97)));
+    TEST_ASSERT_EQUAL(2, towerInfo.neighbors.size());
+    TEST_ASSERT_EQUAL(200, towerInfo.neighbors[0].neighborId);
+    TEST_ASSERT_EQUAL(-97, towerInfo.neighbors[0].signalPower);
+
+    // Equal power is decided by quality
+    TEST_ASSERT(!towerInfo.addNeighbor(makeNeighbor(5110, 200, -97, -10)));
+    TEST_ASSERT(towerInfo.addNeighbor(makeNeighbor(5110, 200, -97, -8)));
+    TEST_ASSERT_EQUAL(-8, towerInfo.neighbors[0].signalQuality);
+
+    // The same ID on another channel, or with another RAT, is a different cell
+    TEST_ASSERT(towerInfo.addNeighbor(makeNeighbor(5230, 200, -110)));
+    QuectelTowerRK::CellularNeighbor otherRat = makeNeighbor(5110, 200, -110);
+    otherRat.rat = QuectelTowerRK::RadioAccessTechnology::LTE;
+    TEST_ASSERT(towerInfo.addNeighbor(otherRat));
+    TEST_ASSERT_EQUAL(4, towerInfo.neighbors.size());
+    TEST_ASSERT_EQUAL(0, towerInfo.neighborsDiscarded);
+
+    // Neighbors added directly are still found
+    towerInfo.neighbors.push_back(makeNeighbor(9, 3, -120));
+    TEST_ASSERT(!towerInfo.addNeighbor(makeNeighbor(9, 3, -121)));
+    TEST_ASSERT_EQUAL(5, towerInfo.neighbors.size());
+    towerInfo.neighbors.erase(0);
+    TEST_ASSERT(towerInfo.addNeighbor(makeNeighbor(5110, 200, -130)));
+    TEST_ASSERT_EQUAL(5, towerInfo.neighbors.size());
+    TEST_ASSERT_EQUAL(0, towerInfo.findNeighbor(5230, 301));
+
+    // After clear() there is nothing to match
+    towerInfo.clear();
+    TEST_ASSERT(towerInfo.addNeighbor(makeNeighbor(5110, 200, -130)));
+    TEST_ASSERT_EQUAL(1, towerInfo.neighbors.size());
+}
+
+static void testServingCell() {
+    QuectelTowerRK::TowerInfo towerInfo;
+    towerInfo.serving.rat = QuectelTowerRK::RadioAccessTechnology::LTE_CAT_M1;
+    towerInfo.serving.mcc = 310;
+    towerInfo.serving.mnc = 410;
+    towerInfo.serving.lac = 0x1A2B;
+    towerInfo.serving.cellId = 0xA1B2C3D;
+    towerInfo.serving.earfcn = 5110;
+    towerInfo.serving.pci = 123;
+    TEST_ASSERT(towerInfo.serving.isValid());
+
+    // Same RAT, channel, and PCI as the serving cell
+    TEST_ASSERT(!towerInfo.addNeighbor(makeNeighbor(5110, 123, -90)));
+    TEST_ASSERT_EQUAL(0, towerInfo.neighbors.size());
+    TEST_ASSERT_EQUAL(0, towerInfo.neighborsDiscarded);
+
+    // Another channel or RAT is a different cell
+    TEST_ASSERT(towerInfo.addNeighbor(makeNeighbor(5230, 123, -90)));
+    QuectelTowerRK::CellularNeighbor otherRat = makeNeighbor(5110, 123, -90);
+    otherRat.rat = QuectelTowerRK::RadioAccessTechnology::LTE;
+    TEST_ASSERT(towerInfo.addNeighbor(otherRat));
+
+    // Without the serving cell's channel, it can't be matched
+    towerInfo.neighbors.clear();
+    towerInfo.serving.earfcn = 0;
+    TEST_ASSERT(towerInfo.addNeighbor(makeNeighbor(5110, 123, -90)));
+
+    // The same from modem responses, with the serving cell parsed first
+    towerInfo.clear();
+    const char *lines[] = {
+        "+QENG: \"servingcell\",\"NOCONN\",\"CAT-M\",\"FDD\",310,410,A1B2C3D,123,5110,12,3,3,1A2B,-95,-10,-65,15,28",
+        "+QENG: \"neighbourcell intra\",\"CAT-M\",5110,123,-10,-95,-65,15,28",
+        "+QENG: \"neighbourcell intra\",\"CAT-M\",5110,200,-12,-101,-70,10,20",
+        "+QENG: \"neighbourcell intra\",\"CAT-M\",5110,200,-11,-99,-70,10,20",
+        "+QENG: \"neighbourcell inter\",\"CAT-M\",5230,123,-14,-108,-75,8,16",
+    };
+    for(const char *line : lines) {
+        TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, towerInfo.parseLine(line, strlen(line)));
+    }
+    TEST_ASSERT_EQUAL(2, towerInfo.neighbors.size());
+    TEST_ASSERT_EQUAL(200, towerInfo.neighbors[0].neighborId);
+    TEST_ASSERT_EQUAL(-99, towerInfo.neighbors[0].signalPower);
+    TEST_ASSERT_EQUAL(5230, towerInfo.neighbors[1].earfcn);
+}
+
+static void testOverflow() {
+    // More neighbors than fit, with distinct signal powers in a scrambled order
+    const size_t numNeighbors = QuectelTowerRK::MAX_NEIGHBORS + 5;
+    std::vector<int> powers;
+    for(size_t ii = 0; ii < numNeighbors; ii++) {
+        powers.push_back((ii % 2 == 0) ? -80 - (int)ii : -200 + (int)ii);
+    }
+
+    QuectelTowerRK::TowerInfo towerInfo;
+    for(size_t ii = 0; ii < numNeighbors; ii++) {
+        bool stored = towerInfo.addNeighbor(makeNeighbor(5110, 100 + ii, powers[ii]));
+        if (ii < QuectelTowerRK::MAX_NEIGHBORS) {
+            TEST_ASSERT(stored);
+        }
+    }
+    TEST_ASSERT_EQUAL(QuectelTowerRK::MAX_NEIGHBORS, towerInfo.neighbors.size());
+    TEST_ASSERT_EQUAL(5, towerInfo.neighborsDiscarded);
+
+    // The strongest MAX_NEIGHBORS are kept
+    std::vector<int> expected = powers;
+    std::sort(expected.begin(), expected.end(), std::greater<int>());
+    expected.resize(QuectelTowerRK::MAX_NEIGHBORS);
+    std::vector<int> kept;
+    for(const QuectelTowerRK::CellularNeighbor &neighbor : towerInfo.neighbors) {
+        kept.push_back(neighbor.signalPower);
+        TEST_ASSERT_EQUAL(powers[neighbor.neighborId - 100], neighbor.signalPower);
+    }
+    std::sort(kept.begin(), kept.end(), std::greater<int>());
+    TEST_ASSERT(kept == expected);
+
+    // Weaker than all of them, or equal to the weakest: discarded
+    TEST_ASSERT(!towerInfo.addNeighbor(makeNeighbor(5110, 999, -200)));
+    TEST_ASSERT(!towerInfo.addNeighbor(makeNeighbor(5110, 998, expected.back())));
+    TEST_ASSERT_EQUAL(7, towerInfo.neighborsDiscarded);
+
+    // Duplicates are still found after a replacement, and don't count as discarded when the list is full
+    TEST_ASSERT(towerInfo.addNeighbor(makeNeighbor(5110, 997, -1)));
+    TEST_ASSERT(!towerInfo.addNeighbor(makeNeighbor(5110, 997, -2)));
+    TEST_ASSERT(towerInfo.addNeighbor(makeNeighbor(5110, 997, 0)));
+    TEST_ASSERT_EQUAL(8, towerInfo.neighborsDiscarded);
+    TEST_ASSERT_EQUAL(QuectelTowerRK::MAX_NEIGHBORS, towerInfo.neighbors.size());
+    for(const QuectelTowerRK::CellularNeighbor &neighbor : towerInfo.neighbors) {
+        TEST_ASSERT(towerInfo.findNeighbor(neighbor.earfcn, neighbor.neighborId) >= 0);
+    }
+}
+
+int main() {
+    testDuplicates();
+    testServingCell();
+    testOverflow();
+    printf("test-neighbors passed\n");
+    return 0;
+}
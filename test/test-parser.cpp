@@ -0,0 +1,196 @@
+// Tests for the AT+QENG response parsers, with response lines from BG9x and EG91 modems
+
+#include "Particle.h"
+#include "QuectelTowerRK.h"
+#include "test.h"
+
+static const int16_t NA = QuectelTowerRK::CellularServing::VALUE_NOT_AVAILABLE;
+
+static int parseServing(QuectelTowerRK::ModemFamily family, QuectelTowerRK::CellularServing &serving, const char *line) {
+    return QuectelTowerRK::getQengParser(family).parseServing(serving, line, strlen(line));
+}
+
+static int parseNeighbor(QuectelTowerRK::ModemFamily family, QuectelTowerRK::CellularNeighbor &neighbor, const char *line) {
+    return QuectelTowerRK::getQengParser(family).parseNeighbor(neighbor, line, strlen(line));
+}
+
+static void checkServing(const QuectelTowerRK::CellularServing &serving, QuectelTowerRK::RadioAccessTechnology rat,
+    unsigned mcc, unsigned mnc, uint32_t cellId, bool tdd, int pci, int earfcn, int band, int ulBandwidth, int dlBandwidth,
+    unsigned lac, int rsrp, int rsrq, int rssi, int sinr, int srxlev) {
+    TEST_ASSERT(serving.rat == rat);
+    TEST_ASSERT_EQUAL(mcc, serving.mcc);
+    TEST_ASSERT_EQUAL(mnc, serving.mnc);
+    TEST_ASSERT_EQUAL(cellId, serving.cellId);
+    TEST_ASSERT_EQUAL(tdd, serving.tdd);
+    TEST_ASSERT_EQUAL(pci, serving.pci);
+    TEST_ASSERT_EQUAL(earfcn, serving.earfcn);
+    TEST_ASSERT_EQUAL(band, serving.band);
+    TEST_ASSERT_EQUAL(ulBandwidth, serving.ulBandwidth);
+    TEST_ASSERT_EQUAL(dlBandwidth, serving.dlBandwidth);
+    TEST_ASSERT_EQUAL(lac, serving.lac);
+    TEST_ASSERT_EQUAL(rsrp, serving.signalPower);
+    TEST_ASSERT_EQUAL(rsrp, serving.rsrp);
+    TEST_ASSERT_EQUAL(rsrq, serving.rsrq);
+    TEST_ASSERT_EQUAL(rssi, serving.rssi);
+    TEST_ASSERT_EQUAL(sinr, serving.sinr);
+    TEST_ASSERT_EQUAL(srxlev, serving.srxlev);
+}
+
+static void checkNeighbor(const QuectelTowerRK::CellularNeighbor &neighbor, QuectelTowerRK::RadioAccessTechnology rat,
+    QuectelTowerRK::NeighborType type, uint32_t earfcn, uint32_t neighborId, int signalQuality, int signalPower, int signalStrength) {
+    TEST_ASSERT(neighbor.rat == rat);
+    TEST_ASSERT(neighbor.type == type);
+    TEST_ASSERT_EQUAL(earfcn, neighbor.earfcn);
+    TEST_ASSERT_EQUAL(neighborId, neighbor.neighborId);
+    TEST_ASSERT_EQUAL(signalQuality, neighbor.signalQuality);
+    TEST_ASSERT_EQUAL(signalPower, neighbor.signalPower);
+    TEST_ASSERT_EQUAL(signalStrength, neighbor.signalStrength);
+}
+
+static void testBg9xServing() {
+    QuectelTowerRK::CellularServing serving;
+
+    for(QuectelTowerRK::ModemFamily family : {QuectelTowerRK::ModemFamily::BG95, QuectelTowerRK::ModemFamily::BG96, QuectelTowerRK::ModemFamily::UNKNOWN}) {
+        TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, parseServing(family, serving,
+            "+QENG: \"servingcell\",\"NOCONN\",\"CAT-M\",\"FDD\",310,410,A1B2C3D,123,5110,12,3,3,1A2B,-95,-10,-65,15,28"));
+        checkServing(serving, QuectelTowerRK::RadioAccessTechnology::LTE_CAT_M1,
+            310, 410, 0xA1B2C3D, false, 123, 5110, 12, 3, 3, 0x1A2B, -95, -10, -65, 15, 28);
+    }
+
+    // BG95 in eMTC mode, TDD, with the optional signal fields not available
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, parseServing(QuectelTowerRK::ModemFamily::BG95, serving,
+        "+QENG: \"servingcell\",\"CONNECT\",\"eMTC\",\"TDD\",262,1,2A1B3C4,405,38950,40,5,5,B00B,-101,-,-,-,-"));
+    checkServing(serving, QuectelTowerRK::RadioAccessTechnology::LTE_CAT_M1,
+        262, 1, 0x2A1B3C4, true, 405, 38950, 40, 5, 5, 0xB00B, -101, NA, NA, NA, NA);
+
+    // NB-IoT, with the optional cell fields not available
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, parseServing(QuectelTowerRK::ModemFamily::BG95, serving,
+        "+QENG: \"servingcell\",\"LIMSRV\",\"CAT-NB\",\"FDD\",310,260,1F2E3D,-,-,-,-,-,2E,-110,-12,-80,3,10"));
+    checkServing(serving, QuectelTowerRK::RadioAccessTechnology::LTE_NB_IOT,
+        310, 260, 0x1F2E3D, false, 0, 0, 0, 0, 0, 0x2E, -110, -12, -80, 3, 10);
+}
+
+static void testEgxxServing() {
+    QuectelTowerRK::CellularServing serving;
+
+    // CQI (12) and tx_power (-) are between sinr and srxlev
+    const char *line = "+QENG: \"servingcell\",\"NOCONN\",\"LTE\",\"FDD\",310,410,A1B2C3D,123,5110,12,3,3,1A2B,-95,-10,-65,15,12,-,28";
+    for(QuectelTowerRK::ModemFamily family : {QuectelTowerRK::ModemFamily::EG91, QuectelTowerRK::ModemFamily::EG21}) {
+        TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, parseServing(family, serving, line));
+        checkServing(serving, QuectelTowerRK::RadioAccessTechnology::LTE,
+            310, 410, 0xA1B2C3D, false, 123, 5110, 12, 3, 3, 0x1A2B, -95, -10, -65, 15, 28);
+    }
+
+    // The BG9x layout would take the CQI as srxlev
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, parseServing(QuectelTowerRK::ModemFamily::BG96, serving, line));
+    TEST_ASSERT_EQUAL(12, serving.srxlev);
+
+    // Connected, TDD, with tx_power and srxlev not available
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, parseServing(QuectelTowerRK::ModemFamily::EG91, serving,
+        "+QENG: \"servingcell\",\"CONNECT\",\"LTE\",\"TDD\",460,0,5F1A2B3,301,38950,40,5,5,2F01,-88,-9,-60,20,7,-,-"));
+    checkServing(serving, QuectelTowerRK::RadioAccessTechnology::LTE,
+        460, 0, 0x5F1A2B3, true, 301, 38950, 40, 5, 5, 0x2F01, -88, -9, -60, 20, NA);
+}
+
+static void testServingRejected() {
+    QuectelTowerRK::CellularServing serving;
+
+    for(QuectelTowerRK::ModemFamily family : {QuectelTowerRK::ModemFamily::BG96, QuectelTowerRK::ModemFamily::EG91}) {
+        // Searching for a cell: no fields after the state
+        TEST_ASSERT_EQUAL(SYSTEM_ERROR_NOT_ENOUGH_DATA, parseServing(family, serving, "+QENG: \"servingcell\",\"SEARCH\""));
+        TEST_ASSERT(!serving.isValid());
+
+        // A required field (rsrp) that is not available
+        TEST_ASSERT_EQUAL(SYSTEM_ERROR_NOT_ENOUGH_DATA, parseServing(family, serving,
+            "+QENG: \"servingcell\",\"NOCONN\",\"LTE\",\"FDD\",310,410,A1B2C3D,123,5110,12,3,3,1A2B,-,-10,-65,15,28"));
+        TEST_ASSERT(!serving.isValid());
+
+        // A neighbor line, and a line that is not a QENG response
+        TEST_ASSERT_EQUAL(SYSTEM_ERROR_NOT_ENOUGH_DATA, parseServing(family, serving,
+            "+QENG: \"neighbourcell intra\",\"LTE\",5110,321,-12,-101,-70,10,20"));
+        TEST_ASSERT_EQUAL(SYSTEM_ERROR_NOT_ENOUGH_DATA, parseServing(family, serving, "OK"));
+
+        // A radio access technology that is not supported
+        TEST_ASSERT_EQUAL(SYSTEM_ERROR_NOT_SUPPORTED, parseServing(family, serving,
+            "+QENG: \"servingcell\",\"NOCONN\",\"GSM\",\"FDD\",310,410,A1B2C3D,123,5110,12,3,3,1A2B,-95,-10,-65,15,28"));
+    }
+}
+
+static void testNeighbor() {
+    QuectelTowerRK::CellularNeighbor neighbor;
+
+    for(QuectelTowerRK::ModemFamily family : {QuectelTowerRK::ModemFamily::BG96, QuectelTowerRK::ModemFamily::EG91}) {
+        TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, parseNeighbor(family, neighbor,
+            "+QENG: \"neighbourcell intra\",\"CAT-M\",5110,321,-12,-101,-70,10,20"));
+        checkNeighbor(neighbor, QuectelTowerRK::RadioAccessTechnology::LTE_CAT_M1, QuectelTowerRK::NeighborType::INTRA,
+            5110, 321, -12, -101, -70);
+
+        // The fields after rssi are optional
+        TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, parseNeighbor(family, neighbor,
+            "+QENG: \"neighbourcell inter\",\"LTE\",5035,17,-15,-110,-80,-,-,-,-,-"));
+        checkNeighbor(neighbor, QuectelTowerRK::RadioAccessTechnology::LTE, QuectelTowerRK::NeighborType::INTER,
+            5035, 17, -15, -110, -80);
+
+        TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, parseNeighbor(family, neighbor,
+            "+QENG: \"neighbourcell other\",\"LTE\",5035,17,-15,-110,-80"));
+        TEST_ASSERT(neighbor.type == QuectelTowerRK::NeighborType::UNKNOWN);
+
+        // Required fields not available, and lines that are not neighbor responses
+        TEST_ASSERT_EQUAL(SYSTEM_ERROR_NOT_ENOUGH_DATA, parseNeighbor(family, neighbor,
+            "+QENG: \"neighbourcell intra\",\"LTE\",5110,321,-12,-,-70"));
+        TEST_ASSERT(!neighbor.isValid());
+        TEST_ASSERT_EQUAL(SYSTEM_ERROR_NOT_ENOUGH_DATA, parseNeighbor(family, neighbor,
+            "+QENG: \"neighbourcell intra\",\"LTE\",5110,321,-12"));
+        TEST_ASSERT_EQUAL(SYSTEM_ERROR_NOT_ENOUGH_DATA, parseNeighbor(family, neighbor,
+            "+QENG: \"servingcell\",\"SEARCH\""));
+        TEST_ASSERT_EQUAL(SYSTEM_ERROR_NOT_SUPPORTED, parseNeighbor(family, neighbor,
+            "+QENG: \"neighbourcell intra\",\"GSM\",5110,321,-12,-101,-70"));
+    }
+}
+
+static int eg91Handler(const char *cmd, system_tick_t timeoutMs, const std::function<int(int, const char *, int)> &callback) {
+    if (strstr(cmd, "AT+CGMM")) {
+        return MockModem::respond(callback, "EG91");
+    }
+    if (strstr(cmd, "\"servingcell\"")) {
+        return MockModem::respond(callback, "+QENG: \"servingcell\",\"NOCONN\",\"LTE\",\"FDD\",310,410,A1B2C3D,123,5110,12,3,3,1A2B,-95,-10,-65,15,12,-,28");
+    }
+    return MockModem::defaultHandler(cmd, timeoutMs, callback);
+}
+
+static void testDetectedFamily() {
+    // The parse functions without a parser use the BG9x layout until the modem family is detected
+    const char *line = "+QENG: \"servingcell\",\"NOCONN\",\"LTE\",\"FDD\",310,410,A1B2C3D,123,5110,12,3,3,1A2B,-95,-10,-65,15,12,-,28";
+    QuectelTowerRK::CellularServing serving;
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, serving.parse(line));
+    TEST_ASSERT_EQUAL(12, serving.srxlev);
+
+    MockModem::setHandler(eg91Handler);
+    QuectelTowerRK &tower = QuectelTowerRK::instance();
+    QuectelTowerRK::TowerInfo towerInfo;
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, tower.scanBlocking(towerInfo, 5000));
+    TEST_ASSERT(tower.getModemFamily() == QuectelTowerRK::ModemFamily::EG91);
+    TEST_ASSERT_EQUAL(28, towerInfo.serving.srxlev);
+
+    // Then the layout of the detected modem
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, serving.parse(line));
+    TEST_ASSERT_EQUAL(28, serving.srxlev);
+
+    towerInfo.clear();
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, towerInfo.parseServing(line));
+    TEST_ASSERT_EQUAL(28, towerInfo.serving.srxlev);
+    towerInfo.clear();
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, towerInfo.parseLine(line, strlen(line)));
+    TEST_ASSERT_EQUAL(28, towerInfo.serving.srxlev);
+    MockModem::setHandler(nullptr);
+}
+
+int main() {
+    testBg9xServing();
+    testEgxxServing();
+    testServingRejected();
+    testNeighbor();
+    testDetectedFamily();
+    printf("test-parser passed\n");
+    return 0;
+}
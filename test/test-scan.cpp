@@ -0,0 +1,344 @@
+// Tests for the worker thread: which scans are saved, and how failures affect later scans
+
+#include "Particle.h"
+#include "QuectelTowerRK.h"
+#include "test.h"
+
+#include <chrono>
+#include <thread>
+
+static int errorHandler(const char *cmd, system_tick_t timeoutMs, const std::function<int(int, const char *, int)> &callback) {
+    if (strstr(cmd, "AT+QENG")) {
+        return RESP_ERROR;
+    }
+    return MockModem::defaultHandler(cmd, timeoutMs, callback);
+}
+
+/**
+ * @brief Leave the modem working, out of backoff, with a good saved scan
+ */
+static void resetModem() {
+    MockModem::setHandler(nullptr);
+    MockModem::setReady(true);
+    System.mockAdvanceMillis(2 * QuectelTowerRK::BACKOFF_MAX_MS);
+
+    QuectelTowerRK::TowerInfo towerInfo;
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, QuectelTowerRK::instance().scanBlocking(towerInfo, 5000));
+    TEST_ASSERT(towerInfo.status == QuectelTowerRK::ScanStatus::COMPLETE);
+}
+
+static void checkSavedScan(uint32_t generation) {
+    QuectelTowerRK &tower = QuectelTowerRK::instance();
+    QuectelTowerRK::TowerInfo towerInfo;
+    tower.getTowerInfo(towerInfo);
+    TEST_ASSERT(towerInfo.status == QuectelTowerRK::ScanStatus::COMPLETE);
+    TEST_ASSERT_EQUAL(0xA1B2C3D, towerInfo.serving.cellId);
+    TEST_ASSERT_EQUAL(2, towerInfo.neighbors.size());
+    TEST_ASSERT_EQUAL(generation, tower.getTowerInfoGeneration());
+}
+
+static void testFailedScanNotSaved() {
+    QuectelTowerRK &tower = QuectelTowerRK::instance();
+    resetModem();
+    uint32_t generation = tower.getTowerInfoGeneration();
+
+    // The callback gets the failure, but the saved scan is unchanged
+    MockModem::setHandler(errorHandler);
+    QuectelTowerRK::TowerInfo towerInfo;
+    tower.scanBlocking(towerInfo, 5000);
+    TEST_ASSERT(towerInfo.status == QuectelTowerRK::ScanStatus::FAILED);
+    TEST_ASSERT(!towerInfo.isValid());
+    checkSavedScan(generation);
+
+    // The non-blocking event handler still attaches the last good scan
+    Variant eventData, locVariant;
+    tower.withEventHandlerNonBlocking();
+    QuectelTowerRK::addToEventHandler(eventData, locVariant);
+    TEST_ASSERT_EQUAL(3, eventData.get("towers").size());
+
+    // The blocking event handler does not attach an empty array when a new scan gets nothing
+    Variant eventData2;
+    tower.withEventHandlerNonBlocking(false).withTowerInfoMaxAge(0);
+    QuectelTowerRK::addToEventHandler(eventData2, locVariant);
+    TEST_ASSERT(eventData2.get("towers").isNull());
+    tower.withTowerInfoMaxAge(QuectelTowerRK::DEFAULT_TOWER_INFO_MAX_AGE_MS);
+}
+
+static void testNotReadyNotSaved() {
+    QuectelTowerRK &tower = QuectelTowerRK::instance();
+    resetModem();
+    uint32_t generation = tower.getTowerInfoGeneration();
+
+    // The callback waits for the first scan after cellular is ready
+    static std::atomic<bool> called;
+    called = false;
+    MockModem::setReady(false);
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, tower.scanWithCallback([](QuectelTowerRK::TowerInfo towerInfo) {
+        called = true;
+    }));
+    delay(200);
+    TEST_ASSERT(!called);
+    checkSavedScan(generation);
+
+    MockModem::setReady(true);
+    QuectelTowerRK::TowerInfo towerInfo;
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, tower.scanBlocking(towerInfo, 5000));
+    TEST_ASSERT(called);
+    checkSavedScan(generation + 1);
+}
+
+static void testServingCellScansOnly() {
+    QuectelTowerRK &tower = QuectelTowerRK::instance();
+    resetModem();
+
+    // Changing the source refreshes the signal once, then periodic mode does not poll the modem
+    tower.withSignalSource(QuectelTowerRK::SignalSource::SERVING_CELL);
+    delay(100);
+    int servingCellCount = MockModem::servingCellCount;
+    int rssiCount = MockModem::rssiCount;
+    delay(3 * QuectelTowerRK::PERIOD_SUCCESS_MS);
+    TEST_ASSERT_EQUAL(servingCellCount, MockModem::servingCellCount);
+    TEST_ASSERT_EQUAL(rssiCount, MockModem::rssiCount);
+
+    // A scan updates the signal
+    QuectelTowerRK::TowerInfo towerInfo;
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, tower.scanBlocking(towerInfo, 5000));
+    TEST_ASSERT_EQUAL(servingCellCount + 1, MockModem::servingCellCount);
+    CellularSignal signal;
+    TEST_ASSERT_EQUAL(0, tower.getSignal(signal));
+    TEST_ASSERT_EQUAL(-95, (int)signal.getStrengthValue());
+
+    tower.withSignalSource(QuectelTowerRK::SignalSource::RSSI);
+}
+
+static void testServingCellPollPeriod() {
+    QuectelTowerRK &tower = QuectelTowerRK::instance();
+    resetModem();
+
+    const unsigned long pollPeriodMs = 500;
+    tower.withSignalSource(QuectelTowerRK::SignalSource::SERVING_CELL, pollPeriodMs);
+    delay(100);
+
+    // A poll is due when the scan request arrives, but the scan's servingcell command is the only one sent
+    System.mockAdvanceMillis(2 * pollPeriodMs);
+    int servingCellCount = MockModem::servingCellCount;
+    QuectelTowerRK::TowerInfo towerInfo;
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, tower.scanBlocking(towerInfo, 5000));
+    TEST_ASSERT_EQUAL(servingCellCount + 1, MockModem::servingCellCount);
+
+    // Without scans, it polls at the period and never calls Cellular.RSSI()
+    int rssiCount = MockModem::rssiCount;
+    delay(pollPeriodMs / 2);
+    TEST_ASSERT_EQUAL(servingCellCount + 1, MockModem::servingCellCount);
+    delay(3 * pollPeriodMs);
+    int polls = MockModem::servingCellCount - (servingCellCount + 1);
+    TEST_ASSERT(polls >= 2 && polls <= 4);
+    TEST_ASSERT_EQUAL(rssiCount, MockModem::rssiCount);
+
+    tower.withSignalSource(QuectelTowerRK::SignalSource::RSSI);
+}
+
+static int getScanFailures() {
+    QuectelTowerRK::ModemHealth health;
+    QuectelTowerRK::instance().getModemHealth(health);
+    return health.scanFailures;
+}
+
+static void testShortBudgetTimeoutNoBackoff() {
+    QuectelTowerRK &tower = QuectelTowerRK::instance();
+    resetModem();
+
+    // A modem that is slow but working: the command times out only because the scan budget is short
+    MockModem::setHandler([](const char *cmd, system_tick_t timeoutMs, const std::function<int(int, const char *, int)> &callback) {
+        const system_tick_t latencyMs = 1500;
+        if (strstr(cmd, "AT+QENG") && timeoutMs < latencyMs) {
+            delay(timeoutMs);
+            return (int)WAIT;
+        }
+        return MockModem::defaultHandler(cmd, timeoutMs, callback);
+    });
+    QuectelTowerRK::TowerInfo towerInfo;
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, tower.scanBlocking(towerInfo, 1000));
+    TEST_ASSERT(towerInfo.status == QuectelTowerRK::ScanStatus::TIMEOUT);
+    TEST_ASSERT_EQUAL(0, getScanFailures());
+
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, tower.scanBlocking(towerInfo, 5000));
+    TEST_ASSERT(towerInfo.status == QuectelTowerRK::ScanStatus::COMPLETE);
+}
+
+static void testFullTimeoutBacksOff() {
+    QuectelTowerRK &tower = QuectelTowerRK::instance();
+    resetModem();
+
+    // No answer within the full command timeout (reported right away, to keep the test fast)
+    MockModem::setHandler([](const char *cmd, system_tick_t timeoutMs, const std::function<int(int, const char *, int)> &callback) {
+        if (strstr(cmd, "AT+QENG")) {
+            return (int)WAIT;
+        }
+        return MockModem::defaultHandler(cmd, timeoutMs, callback);
+    });
+    QuectelTowerRK::TowerInfo towerInfo;
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, tower.scanBlocking(towerInfo, 30000));
+    TEST_ASSERT(towerInfo.status == QuectelTowerRK::ScanStatus::FAILED);
+    TEST_ASSERT_EQUAL(1, getScanFailures());
+
+    // The next scan does not use the modem
+    int commandCount = MockModem::commandCount;
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_BUSY, tower.scanBlocking(towerInfo, 5000));
+    TEST_ASSERT(towerInfo.status == QuectelTowerRK::ScanStatus::BACKOFF);
+    TEST_ASSERT_EQUAL(commandCount, MockModem::commandCount);
+}
+
+static void testNeighborErrorNoBackoff() {
+    QuectelTowerRK &tower = QuectelTowerRK::instance();
+    resetModem();
+
+    MockModem::setHandler([](const char *cmd, system_tick_t timeoutMs, const std::function<int(int, const char *, int)> &callback) {
+        if (strstr(cmd, "\"neighbourcell\"")) {
+            return (int)RESP_ERROR;
+        }
+        return MockModem::defaultHandler(cmd, timeoutMs, callback);
+    });
+    // After a good serving cell, ERROR is an empty neighbor list and the scan is complete
+    QuectelTowerRK::TowerInfo towerInfo;
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, tower.scanBlocking(towerInfo, 5000));
+    TEST_ASSERT(towerInfo.status == QuectelTowerRK::ScanStatus::COMPLETE);
+    TEST_ASSERT(towerInfo.contents == QuectelTowerRK::ScanOptions::ALL);
+    TEST_ASSERT_EQUAL(0, towerInfo.neighbors.size());
+    TEST_ASSERT_EQUAL(0, getScanFailures());
+
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, tower.scanBlocking(towerInfo, 5000));
+    TEST_ASSERT(towerInfo.status == QuectelTowerRK::ScanStatus::COMPLETE);
+
+    // So the saved scan is served from the cache without using the modem
+    uint32_t commandCount = MockModem::commandCount;
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, tower.scanIfOlderThan(towerInfo, 60000, 5000));
+    TEST_ASSERT(towerInfo.isFresh(60000));
+    TEST_ASSERT_EQUAL(commandCount, MockModem::commandCount);
+
+    // Without the serving cell, a neighbourcell ERROR is not an empty list
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, tower.scanBlocking(towerInfo, 5000, QuectelTowerRK::ScanOptions::NEIGHBORS));
+    TEST_ASSERT(towerInfo.status == QuectelTowerRK::ScanStatus::FAILED);
+
+    // A serving cell error is a failure
+    MockModem::setHandler(errorHandler);
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, tower.scanBlocking(towerInfo, 5000));
+    TEST_ASSERT(towerInfo.status == QuectelTowerRK::ScanStatus::FAILED);
+    TEST_ASSERT_EQUAL(1, getScanFailures());
+}
+
+static std::atomic<bool> modemGate;
+
+static int gatedHandler(const char *cmd, system_tick_t timeoutMs, const std::function<int(int, const char *, int)> &callback) {
+    // Holds the scan until the test has subscribed everything
+    while(strstr(cmd, "AT+QENG") && !modemGate) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return MockModem::defaultHandler(cmd, timeoutMs, callback);
+}
+
+/**
+ * @brief Wait up to 2 seconds of real time for flag to be set
+ */
+static bool waitFor(const std::atomic<bool> &flag) {
+    for(int ii = 0; ii < 2000 && !flag; ii++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return flag;
+}
+
+static void testCallbacksWithoutMutex() {
+    QuectelTowerRK &tower = QuectelTowerRK::instance();
+    resetModem();
+
+    static std::atomic<bool> firstRunning, firstRelease, firstDone, secondCalled, thirdCalled;
+    firstRunning = firstRelease = firstDone = secondCalled = thirdCalled = false;
+    modemGate = false;
+    MockModem::setHandler(gatedHandler);
+
+    QuectelTowerRK::ScanId firstId, secondId, thirdId;
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, tower.scanWithCallbackRef([](const QuectelTowerRK::TowerInfo &towerInfo) {
+        firstRunning = true;
+        waitFor(firstRelease);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        firstDone = true;
+    }, &firstId, 5000));
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, tower.scanWithCallbackRef([](const QuectelTowerRK::TowerInfo &towerInfo) {
+        secondCalled = true;
+    }, &secondId, 5000));
+    modemGate = true;
+    TEST_ASSERT(waitFor(firstRunning));
+
+    // While a callback runs, other threads can start a scan, and cancel a callback that has not been called yet
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, tower.scanWithCallbackRef([](const QuectelTowerRK::TowerInfo &towerInfo) {
+        thirdCalled = true;
+    }, &thirdId, 5000));
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, tower.cancelScan(secondId));
+    firstRelease = true;
+
+    // Cancelling the running callback waits for it to return
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NOT_FOUND, tower.cancelScan(firstId));
+    TEST_ASSERT(firstDone);
+
+    // The third request subscribed to the next scan
+    TEST_ASSERT(waitFor(thirdCalled));
+    TEST_ASSERT(!secondCalled);
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NOT_FOUND, tower.cancelScan(thirdId));
+    MockModem::setHandler(nullptr);
+}
+
+static void testStatusPerRequest() {
+    QuectelTowerRK &tower = QuectelTowerRK::instance();
+    resetModem();
+
+    // Nothing to scan
+    QuectelTowerRK::TowerInfo towerInfo;
+    QuectelTowerRK::ScanId scanId;
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_INVALID_ARGUMENT, tower.scanBlocking(towerInfo, 5000, QuectelTowerRK::ScanOptions::NONE));
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_INVALID_ARGUMENT, tower.startScan(QuectelTowerRK::ScanOptions::NONE));
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_INVALID_ARGUMENT, tower.startScan(scanId, 5000, QuectelTowerRK::ScanOptions::NONE));
+
+    // A serving cell request and a full request share a scan where the neighbor cells get no answer
+    modemGate = false;
+    MockModem::setHandler([](const char *cmd, system_tick_t timeoutMs, const std::function<int(int, const char *, int)> &callback) {
+        if (strstr(cmd, "\"neighbourcell\"")) {
+            return (int)WAIT;
+        }
+        return gatedHandler(cmd, timeoutMs, callback);
+    });
+    static std::atomic<bool> servingDone, allDone;
+    static QuectelTowerRK::ScanStatus servingStatus, allStatus;
+    servingDone = allDone = false;
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, tower.scanWithCallbackRef([](const QuectelTowerRK::TowerInfo &towerInfo) {
+        servingStatus = towerInfo.status;
+        servingDone = true;
+    }, nullptr, 30000, QuectelTowerRK::ScanOptions::SERVING));
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, tower.scanWithCallbackRef([](const QuectelTowerRK::TowerInfo &towerInfo) {
+        allStatus = towerInfo.status;
+        allDone = true;
+    }, nullptr, 30000, QuectelTowerRK::ScanOptions::ALL));
+    modemGate = true;
+    TEST_ASSERT(waitFor(servingDone) && waitFor(allDone));
+
+    // Each request gets the status for what it asked for
+    TEST_ASSERT(servingStatus == QuectelTowerRK::ScanStatus::COMPLETE);
+    TEST_ASSERT(allStatus == QuectelTowerRK::ScanStatus::PARTIAL);
+    tower.getTowerInfo(towerInfo);
+    TEST_ASSERT(towerInfo.status == QuectelTowerRK::ScanStatus::PARTIAL);
+    TEST_ASSERT(towerInfo.contents == QuectelTowerRK::ScanOptions::SERVING);
+    MockModem::setHandler(nullptr);
+}
+
+int main() {
+    testFailedScanNotSaved();
+    testNotReadyNotSaved();
+    testServingCellScansOnly();
+    testServingCellPollPeriod();
+    testShortBudgetTimeoutNoBackoff();
+    testFullTimeoutBacksOff();
+    testNeighborErrorNoBackoff();
+    testCallbacksWithoutMutex();
+    testStatusPerRequest();
+    printf("test-scan passed\n");
+    return 0;
+}
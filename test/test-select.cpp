@@ -0,0 +1,198 @@
+// Tests for TowerInfo::selectTowers(): the selected towers fit the byte budget and encodedSize is exact,
+// and for the strongest-first order of getStrongestNeighbors() used when towers are left out
+
+#include "Particle.h"
+#include "QuectelTowerRK.h"
+#include "test.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+static QuectelTowerRK::CellularNeighbor makeNeighbor(uint32_t earfcn, uint32_t neighborId, int signalPower) {
+    QuectelTowerRK::CellularNeighbor neighbor;
+    neighbor.rat = QuectelTowerRK::RadioAccessTechnology::LTE_CAT_M1;
+    neighbor.earfcn = earfcn;
+    neighbor.neighborId = neighborId;
+    neighbor.signalPower = signalPower;
+    return neighbor;
+}
+
+/**
+ * @brief A scan whose neighbors have different encoded sizes, so a shorter one can fit after a longer one did not
+ */
+static void makeTowerInfo(QuectelTowerRK::TowerInfo &towerInfo) {
+    towerInfo.clear();
+    towerInfo.serving.rat = QuectelTowerRK::RadioAccessTechnology::LTE_CAT_M1;
+    towerInfo.serving.mcc = 310;
+    towerInfo.serving.mnc = 410;
+    towerInfo.serving.lac = 0x1A2B;
+    towerInfo.serving.cellId = 0xA1B2C3D;
+    towerInfo.serving.signalPower = -95;
+    towerInfo.addNeighbor(makeNeighbor(5110, 200, -101));
+    towerInfo.addNeighbor(makeNeighbor(65535, 100000, -99));
+    towerInfo.addNeighbor(makeNeighbor(9, 3, -120));
+    towerInfo.addNeighbor(makeNeighbor(5230, 301, -108));
+    towerInfo.addNeighbor(makeNeighbor(70000, 123456, -100));
+}
+
+static std::string toJson(const QuectelTowerRK::TowerInfo &towerInfo, const QuectelTowerRK::TowerSelection &selection) {
+    char buf[1024];
+    JSONBufferWriter writer(buf, sizeof(buf));
+    towerInfo.toJsonWriter(writer, selection);
+    TEST_ASSERT(writer.dataSize() < sizeof(buf));
+    return std::string(buf, writer.dataSize());
+}
+
+static void testEncodedSize() {
+    QuectelTowerRK::TowerInfo towerInfo;
+    makeTowerInfo(towerInfo);
+
+    QuectelTowerRK::TowerSelection all;
+    TEST_ASSERT_EQUAL(6, towerInfo.selectTowers(1024, all));
+    TEST_ASSERT_EQUAL(0, all.towersOmitted);
+    size_t fullSize = toJson(towerInfo, all).size();
+
+    // Every budget from too small for anything to enough for everything
+    for(size_t maxBytes = 0; maxBytes <= fullSize + 1; maxBytes++) {
+        QuectelTowerRK::TowerSelection selection;
+        size_t numTowers = towerInfo.selectTowers(maxBytes, selection);
+        TEST_ASSERT_EQUAL(numTowers, selection.numTowers());
+        TEST_ASSERT_EQUAL(6, numTowers + selection.towersOmitted);
+
+        if (numTowers == 0) {
+            TEST_ASSERT_EQUAL(0, selection.encodedSize);
+            continue;
+        }
+        std::string json = toJson(towerInfo, selection);
+        TEST_ASSERT_EQUAL(json.size(), selection.encodedSize);
+        TEST_ASSERT(json.size() <= maxBytes);
+
+#ifdef SYSTEM_VERSION_v620
+        Variant obj;
+        towerInfo.toVariant(obj, selection);
+        TEST_ASSERT(json == obj.toJSON().c_str());
+#endif // SYSTEM_VERSION_v620
+    }
+}
+
+static void testServingFirst() {
+    QuectelTowerRK::TowerInfo towerInfo;
+    makeTowerInfo(towerInfo);
+
+    QuectelTowerRK::TowerSelection selection;
+    selection.includeServing = true;
+    std::string servingOnly = toJson(towerInfo, selection);
+
+    // Too small for the serving cell: nothing, even though a neighbor would fit
+    TEST_ASSERT_EQUAL(0, towerInfo.selectTowers(servingOnly.size() - 1, selection));
+    TEST_ASSERT(!selection.includeServing);
+    TEST_ASSERT_EQUAL(0, selection.neighborIndexes.size());
+    TEST_ASSERT_EQUAL(0, selection.encodedSize);
+    TEST_ASSERT_EQUAL(6, selection.towersOmitted);
+
+    // Just the serving cell
+    TEST_ASSERT_EQUAL(1, towerInfo.selectTowers(servingOnly.size(), selection));
+    TEST_ASSERT(selection.includeServing);
+    TEST_ASSERT(toJson(towerInfo, selection) == servingOnly);
+
+    // A shorter neighbor (33 bytes with the comma) is included after longer, stronger ones did not fit
+    TEST_ASSERT_EQUAL(2, towerInfo.selectTowers(servingOnly.size() + 34, selection));
+    TEST_ASSERT_EQUAL(1, selection.neighborIndexes.size());
+    TEST_ASSERT_EQUAL(0, selection.neighborIndexes[0]);
+
+    // Without a serving cell, neighbors are selected on their own
+    QuectelTowerRK::TowerInfo neighborsOnly;
+    neighborsOnly.addNeighbor(makeNeighbor(5110, 200, -101));
+    TEST_ASSERT_EQUAL(1, neighborsOnly.selectTowers(1024, selection));
+    TEST_ASSERT(toJson(neighborsOnly, selection) == "[{\"nid\":200,\"ch\":5110,\"str\":-101}]");
+    TEST_ASSERT_EQUAL(toJson(neighborsOnly, selection).size(), selection.encodedSize);
+
+    // Nothing to select
+    QuectelTowerRK::TowerInfo empty;
+    TEST_ASSERT_EQUAL(0, empty.selectTowers(1024, selection));
+    TEST_ASSERT_EQUAL(0, selection.towersOmitted);
+}
+
+/**
+ * @brief The order getStrongestNeighbors() must match: a stable sort by signalPower, then signalQuality
+ */
+static std::vector<uint16_t> referenceOrder(const QuectelTowerRK::TowerInfo &towerInfo) {
+    std::vector<uint16_t> indexes;
+    for(size_t ii = 0; ii < towerInfo.neighbors.size(); ii++) {
+        indexes.push_back((uint16_t)ii);
+    }
+    std::stable_sort(indexes.begin(), indexes.end(), [&towerInfo](uint16_t a, uint16_t b) {
+        const QuectelTowerRK::CellularNeighbor &na = towerInfo.neighbors[a];
+        const QuectelTowerRK::CellularNeighbor &nb = towerInfo.neighbors[b];
+        if (na.signalPower != nb.signalPower) {
+            return na.signalPower > nb.signalPower;
+        }
+        return na.signalQuality > nb.signalQuality;
+    });
+    return indexes;
+}
+
+static void testStrongestTies() {
+    QuectelTowerRK::TowerInfo towerInfo;
+    int values[][2] = {{-100, -12}, {-95, -15}, {-100, -10}, {-100, -12}, {-95, -15}, {-110, -5}};
+    for(size_t ii = 0; ii < sizeof(values) / sizeof(values[0]); ii++) {
+        QuectelTowerRK::CellularNeighbor neighbor = makeNeighbor(5110, 100 + ii, values[ii][0]);
+        neighbor.signalQuality = values[ii][1];
+        towerInfo.neighbors.push_back(neighbor);
+    }
+
+    // Equal power is ordered by quality, and equal power and quality keep the modem order
+    QuectelTowerRK::InlineVector<uint16_t, QuectelTowerRK::MAX_NEIGHBORS> indexes;
+    towerInfo.getStrongestNeighbors(indexes);
+    std::vector<uint16_t> expected = {1, 4, 2, 0, 3, 5};
+    TEST_ASSERT(std::vector<uint16_t>(indexes.begin(), indexes.end()) == expected);
+
+    // Truncation keeps the tie-break
+    towerInfo.getStrongestNeighbors(indexes, 4);
+    TEST_ASSERT(std::vector<uint16_t>(indexes.begin(), indexes.end()) == std::vector<uint16_t>(expected.begin(), expected.begin() + 4));
+    towerInfo.getStrongestNeighbors(indexes, 1);
+    TEST_ASSERT_EQUAL(1, indexes.size());
+    TEST_ASSERT_EQUAL(1, indexes[0]);
+
+    // toJsonWriter() with numToInclude writes the same order
+    char buf[512];
+    JSONBufferWriter writer(buf, sizeof(buf));
+    towerInfo.toJsonWriter(writer, 3);
+    TEST_ASSERT(std::string(buf, writer.dataSize()) == 
+        "[{\"nid\":101,\"ch\":5110,\"str\":-95},{\"nid\":104,\"ch\":5110,\"str\":-95},{\"nid\":102,\"ch\":5110,\"str\":-100}]");
+}
+
+static void testStrongestRandom() {
+    // Few distinct values, so there are many ties
+    uint32_t seed = 7;
+    for(int round = 0; round < 500; round++) {
+        QuectelTowerRK::TowerInfo towerInfo;
+        seed = seed * 1103515245 + 12345;
+        size_t numNeighbors = (seed >> 16) % (QuectelTowerRK::MAX_NEIGHBORS + 1);
+        for(size_t ii = 0; ii < numNeighbors; ii++) {
+            seed = seed * 1103515245 + 12345;
+            QuectelTowerRK::CellularNeighbor neighbor = makeNeighbor(5110, 100 + ii, -100 - (int)((seed >> 12) % 4));
+            neighbor.signalQuality = -10 - (int)((seed >> 20) % 3);
+            towerInfo.neighbors.push_back(neighbor);
+        }
+        std::vector<uint16_t> expected = referenceOrder(towerInfo);
+
+        for(size_t maxCount = 0; maxCount <= numNeighbors + 1; maxCount++) {
+            QuectelTowerRK::InlineVector<uint16_t, QuectelTowerRK::MAX_NEIGHBORS> indexes;
+            towerInfo.getStrongestNeighbors(indexes, maxCount);
+            size_t count = (maxCount == 0 || maxCount > numNeighbors) ? numNeighbors : maxCount;
+            TEST_ASSERT_EQUAL(count, indexes.size());
+            TEST_ASSERT(std::vector<uint16_t>(indexes.begin(), indexes.end()) == std::vector<uint16_t>(expected.begin(), expected.begin() + count));
+        }
+    }
+}
+
+int main() {
+    testEncodedSize();
+    testServingFirst();
+    testStrongestTies();
+    testStrongestRandom();
+    printf("test-select passed\n");
+    return 0;
+}
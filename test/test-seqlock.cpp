@@ -0,0 +1,154 @@
+// Stress tests for SeqLocked and the double-buffered saved TowerInfo: readers must never see a torn copy
+
+#include "Particle.h"
+#include "QuectelTowerRK.h"
+#include "test.h"
+
+#include <chrono>
+#include <thread>
+
+static const int NUM_READERS = 3;
+static const auto TEST_DURATION = std::chrono::milliseconds(1500);
+
+/**
+ * @brief Fill every field that a reader checks from a single counter
+ */
+static void fillTowerInfo(QuectelTowerRK::TowerInfo &towerInfo, uint32_t k) {
+    towerInfo.clear();
+    towerInfo.serving.rat = QuectelTowerRK::RadioAccessTechnology::LTE;
+    towerInfo.serving.cellId = k;
+    towerInfo.serving.mcc = k % 1000;
+    towerInfo.serving.lac = k & 0xffff;
+    towerInfo.serving.signalPower = -(int)(k % 100);
+    for(uint32_t ii = 0; ii < 1 + k % QuectelTowerRK::MAX_NEIGHBORS; ii++) {
+        QuectelTowerRK::CellularNeighbor neighbor;
+        neighbor.rat = QuectelTowerRK::RadioAccessTechnology::LTE;
+        neighbor.neighborId = k + ii;
+        neighbor.earfcn = k ^ ii;
+        neighbor.signalPower = -(int)ii;
+        towerInfo.neighbors.push_back(neighbor);
+    }
+}
+
+/**
+ * @brief Check that every field came from the same counter value, and return it
+ */
+static uint32_t checkTowerInfo(const QuectelTowerRK::TowerInfo &towerInfo) {
+    uint32_t k = towerInfo.serving.cellId;
+    TEST_ASSERT_EQUAL(k % 1000, towerInfo.serving.mcc);
+    TEST_ASSERT_EQUAL(k & 0xffff, towerInfo.serving.lac);
+    TEST_ASSERT_EQUAL(-(int)(k % 100), towerInfo.serving.signalPower);
+    TEST_ASSERT_EQUAL(1 + k % QuectelTowerRK::MAX_NEIGHBORS, towerInfo.neighbors.size());
+    for(uint32_t ii = 0; ii < towerInfo.neighbors.size(); ii++) {
+        TEST_ASSERT_EQUAL(k + ii, towerInfo.neighbors[ii].neighborId);
+        TEST_ASSERT_EQUAL(k ^ ii, towerInfo.neighbors[ii].earfcn);
+    }
+    return k;
+}
+
+static void testSeqLocked() {
+    static QuectelTowerRK::SeqLocked<QuectelTowerRK::TowerInfo> seqLocked;
+    std::atomic<bool> done {false};
+    std::atomic<uint64_t> totalReads {0};
+
+    fillTowerInfo(seqLocked.beginWrite(), 0);
+    seqLocked.endWrite();
+
+    std::vector<std::thread> readers;
+    for(int ii = 0; ii < NUM_READERS; ii++) {
+        readers.emplace_back([&]() {
+            QuectelTowerRK::TowerInfo towerInfo;
+            uint32_t lastK = 0;
+            uint64_t reads = 0;
+            while(!done) {
+                seqLocked.read(towerInfo);
+                uint32_t k = checkTowerInfo(towerInfo);
+                TEST_ASSERT(k >= lastK);
+                lastK = k;
+                reads++;
+            }
+            totalReads += reads;
+        });
+    }
+
+    uint32_t writes = 0;
+    auto end = std::chrono::steady_clock::now() + TEST_DURATION;
+    while(std::chrono::steady_clock::now() < end) {
+        fillTowerInfo(seqLocked.beginWrite(), ++writes);
+        seqLocked.endWrite();
+    }
+    done = true;
+    for(std::thread &reader : readers) {
+        reader.join();
+    }
+    printf("SeqLocked: %u writes, %llu consistent reads\n", (unsigned)writes, (unsigned long long)totalReads);
+}
+
+static void testSavedTowerInfo() {
+    // Each scan returns a serving cell and neighbors that all encode the same counter
+    static std::atomic<uint32_t> scanCounter {0};
+    MockModem::setHandler([](const char *cmd, system_tick_t timeoutMs, const std::function<int(int, const char *, int)> &callback) {
+        char lines[1024];
+        if (strstr(cmd, "\"servingcell\"")) {
+            uint32_t k = ++scanCounter;
+            snprintf(lines, sizeof(lines), "+QENG: \"servingcell\",\"NOCONN\",\"LTE\",\"FDD\",%u,410,%X,123,5110,12,3,3,%X,-%u,-10,-65,15,28",
+                (unsigned)(k % 1000), (unsigned)k, (unsigned)(k & 0xffff), (unsigned)(k % 100));
+            return MockModem::respond(callback, lines);
+        }
+        if (strstr(cmd, "\"neighbourcell\"")) {
+            uint32_t k = scanCounter;
+            size_t offset = 0;
+            for(uint32_t ii = 0; ii < 1 + k % QuectelTowerRK::MAX_NEIGHBORS; ii++) {
+                offset += snprintf(&lines[offset], sizeof(lines) - offset, "%s+QENG: \"neighbourcell intra\",\"LTE\",%u,%u,-12,-%u,-70",
+                    ii ? "\n" : "", (unsigned)(k ^ ii), (unsigned)(k + ii), (unsigned)ii);
+            }
+            return MockModem::respond(callback, lines);
+        }
+        return MockModem::defaultHandler(cmd, timeoutMs, callback);
+    });
+
+    QuectelTowerRK &tower = QuectelTowerRK::instance();
+    QuectelTowerRK::TowerInfo towerInfo;
+    TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, tower.scanBlocking(towerInfo, 5000));
+
+    std::atomic<bool> done {false};
+    std::atomic<uint64_t> totalReads {0};
+    std::vector<std::thread> readers;
+    for(int ii = 0; ii < NUM_READERS; ii++) {
+        readers.emplace_back([&]() {
+            QuectelTowerRK::TowerInfo readInfo;
+            uint32_t lastK = 0;
+            uint64_t reads = 0;
+            while(!done) {
+                tower.getTowerInfo(readInfo);
+                uint32_t k = checkTowerInfo(readInfo);
+                TEST_ASSERT(k >= lastK);
+                lastK = k;
+                reads++;
+            }
+            totalReads += reads;
+        });
+    }
+
+    // The worker thread is the writer
+    uint32_t scans = 0;
+    auto end = std::chrono::steady_clock::now() + TEST_DURATION;
+    while(std::chrono::steady_clock::now() < end) {
+        TEST_ASSERT_EQUAL(SYSTEM_ERROR_NONE, tower.scanBlocking(towerInfo, 5000));
+        checkTowerInfo(towerInfo);
+        scans++;
+    }
+    done = true;
+    for(std::thread &reader : readers) {
+        reader.join();
+    }
+    MockModem::setHandler(nullptr);
+    printf("getTowerInfo: %u scans, %llu consistent reads\n", (unsigned)scans, (unsigned long long)totalReads);
+}
+
+int main() {
+    testSeqLocked();
+    testSavedTowerInfo();
+    printf("test-seqlock passed\n");
+    return 0;
+}
@@ -0,0 +1,23 @@
+// Assertion helpers shared by the host unit tests
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+/**
+ * @brief Stop the test with a message if the condition is false
+ */
+#define TEST_ASSERT(cond) \
+    do { if (!(cond)) { printf("%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #cond); exit(1); } } while (false)
+
+/**
+ * @brief Stop the test with a message if the values are not equal. The values must convert to long long.
+ */
+#define TEST_ASSERT_EQUAL(expected, actual) \
+    do { \
+        long long _expected = (long long)(expected), _actual = (long long)(actual); \
+        if (_expected != _actual) { \
+            printf("%s:%d: expected %s == %lld, got %lld\n", __FILE__, __LINE__, #actual, _expected, _actual); \
+            exit(1); \
+        } \
+    } while (false)
@@ -0,0 +1,41 @@
+// Convert the output of QuectelTowerRK::TowerInfo::toCbor() to the JSON from toJsonWriter()
+//
+// This runs on a computer, not a device, and only needs src/QuectelTowerCbor.h:
+//
+//   c++ -std=c++11 -Isrc -o cbor2json tools/cbor2json.cpp
+//   ./cbor2json < towers.cbor
+
+#include "QuectelTowerCbor.h"
+
+#include <stdio.h>
+#include <vector>
+
+int main() {
+    std::vector<uint8_t> data;
+    int ch;
+    while((ch = getchar()) != EOF) {
+        data.push_back((uint8_t)ch);
+    }
+
+    bool first = true;
+    printf("[");
+    bool success = QuectelTowerCbor::decode(data.data(), data.size(), [&first](const QuectelTowerCbor::Tower &tower) {
+        printf("%s", first ? "" : ",");
+        first = false;
+        if (tower.isServing) {
+            printf("{\"rat\":\"lte\",\"mcc\":%u,\"mnc\":%u,\"lac\":%u,\"cid\":%u,\"str\":%d}",
+                tower.mcc, tower.mnc, tower.lac, (unsigned)tower.cellId, tower.signalPower);
+        }
+        else {
+            printf("{\"nid\":%u,\"ch\":%u,\"str\":%d}", (unsigned)tower.neighborId, (unsigned)tower.channel, tower.signalPower);
+        }
+        return true;
+    });
+    printf("]\n");
+
+    if (!success) {
+        fprintf(stderr, "not valid toCbor() data\n");
+        return 1;
+    }
+    return 0;
+}